@@ -1,6 +1,18 @@
 #include "arena_alloc.hh"
 #include <vector>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <optional>
+#include <unordered_map>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <random>
+#include <charconv>
+#include <cstdint>
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
@@ -10,6 +22,30 @@
 #include <Windows.h>
 #else
 #include <sys/mman.h>
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+// ‘__GLIBC_PREREQ’ is only defined by glibc, and an undefined function-like
+// macro is an error in ‘#if’, so it is tested on its own.
+#if defined (__GLIBC__)
+#if __GLIBC_PREREQ (2, 29)
+#define ARENA_HAS_GETCPU
+#endif
+#endif
+#endif
+#if __has_include (<execinfo.h>)
+#include <execinfo.h>
+#define ARENA_HAS_BACKTRACE
+#endif
+#endif
+
+// Global state is constant-initialized, so it is usable from other static
+// initializers and costs nothing in programs not using the allocator.
+#ifdef __cpp_constinit
+#define ARENA_CONSTINIT constinit
+#else
+#define ARENA_CONSTINIT
 #endif
 
 namespace arena
@@ -68,58 +104,418 @@ deallocate_memory (char *p, std::size_t n)
 
 #endif
 
+struct SystemMemoryProvider final : MemoryProvider
+{
+  void *
+  allocate (std::size_t n) override
+  {
+    return allocate_memory (n);
+  }
+
+  void
+  deallocate (void *p, std::size_t n) override
+  {
+    deallocate_memory (static_cast<char *> (p), n);
+  }
+};
+
+// Never destroyed, so arenas destroyed during static destruction can still
+// unmap their regions.
+static ARENA_CONSTINIT union SystemMemory
+{
+  constexpr SystemMemory () : provider () {}
+  ~SystemMemory () {}
+  SystemMemoryProvider provider;
+} S_system_memory {};
+
+static inline char *
+provider_allocate (MemoryProvider &provider, std::size_t n)
+{
+  void *p = provider.allocate (n);
+  if (p == nullptr)
+    {
+      std::fputs ("arena: memory provider failed\n", stderr);
+      exit (1);
+    }
+  return static_cast<char *> (p);
+}
+
+using idle_clock = std::chrono::steady_clock;
+
+/// Bookkeeping of the scavenger, only accessed by it.
+struct IdleState
+{
+  std::uint64_t seen_allocations = 0;
+  idle_clock::time_point active_since {};
+  idle_clock::time_point empty_since {};
+  bool empty = false;
+  bool purged = false;
+  bool cold = false;
+};
+
 struct Region
 {
   enum : std::size_t { S_capacity = 4096 };
 
-  Region (std::size_t min_cap)
-    : M_capacity (std::max (static_cast<std::size_t> (S_capacity), min_cap))
-    , M_data (allocate_memory (M_capacity))
+  Region (std::size_t capacity, MemoryProvider &provider,
+          Temperature temperature, unsigned size_class)
+    : M_capacity (capacity)
+    , M_provider (&provider)
+    , M_data (provider_allocate (provider, M_capacity))
     , M_size (0)
     , M_ref_count (0)
+    , M_temperature (temperature)
+    , M_size_class (size_class)
   {}
 
-  void destruct () { deallocate_memory (M_data, M_capacity); }
+  /// Regions not placed on a NUMA node.
+  static constexpr int S_any_node = -1;
+
+  void destruct () { M_provider->deallocate (M_data, M_capacity); }
 
   char * data () { return M_data; }
   char * top () { return M_data + M_size; }
   char * end () { return M_data + M_capacity; }
+  std::size_t capacity () const { return M_capacity; }
   void resize (std::ptrdiff_t diff) { M_size += diff; }
   void clear () { M_size = 0; }
-  void ref () { ++M_ref_count; }
+  void release () { M_size = 0; M_ref_count = 0; }
+  bool empty () const { return M_ref_count == 0 && M_size == 0; }
+  void
+  retag (Temperature temperature, unsigned size_class)
+  {
+    M_temperature = temperature;
+    M_size_class = size_class;
+  }
+  void ref () { ++M_ref_count; ++M_allocations; }
   void unref () { --M_ref_count; }
   bool unused () const { return M_ref_count == 0; }
+  std::uint64_t allocations () const { return M_allocations; }
+  const MemoryProvider * provider () const { return M_provider; }
+  Temperature temperature () const { return M_temperature; }
+  unsigned size_class () const { return M_size_class; }
+  int node () const { return M_node; }
+  void place (int node) { M_node = node; }
+  // Set while the scavenger frees the pages without the lock held.
+  bool purging () const { return M_purging; }
+  void set_purging (bool purging) { M_purging = purging; }
+
+  IdleState idle {};
 
 private:
-  const std::size_t M_capacity;
+  std::size_t M_capacity;
+  MemoryProvider *M_provider;
   char *M_data;
   std::size_t M_size;
   unsigned M_ref_count;
+  Temperature M_temperature;
+  unsigned char M_size_class;
+  int M_node = S_any_node;
+  bool M_purging = false;
+  std::uint64_t M_allocations = 0;
+};
+
+/**
+ * Allocations are segregated into separate region chains by size and
+ * alignment, so small nodes are not interleaved with larger buffers and
+ * differently aligned allocations don't waste space on padding.
+ */
+enum : unsigned
+{
+  S_alignment_classes = 5,
+  S_size_classes = 4 * S_alignment_classes,
+  S_temperatures = 3,
+  // Nodes sharing an active region index; ‘fits’ tells their regions apart.
+  S_node_hints = 8,
+  // Regions created by ‘reserve_contiguous’ are not part of any chain.
+  S_reserved_class = S_size_classes,
 };
 
+// Largest allocation of each size class, without alignment.
+static constexpr std::size_t S_size_limits[] = { 64, 1024, 16384, SIZE_MAX };
+
+static inline unsigned
+size_class_of (std::size_t n, std::size_t alignment)
+{
+  unsigned size_class = 0;
+  while (n > S_size_limits[size_class])
+    ++size_class;
+  unsigned alignment_class = 0;
+  while (alignment > 1 && alignment_class < S_alignment_classes - 1)
+    {
+      alignment >>= 1;
+      ++alignment_class;
+    }
+  return size_class * S_alignment_classes + alignment_class;
+}
+
 using region_list = std::vector<Region>;
 using region_iterator = region_list::iterator;
 
-static region_list *S_regions {};
+/**
+ * Chooses the capacity of new regions.
+ *
+ * Keeps a histogram of requested sizes, weighted by bytes and decayed over
+ * time.  New regions are made large enough that a typical allocation of their
+ * size class only wastes a small fraction of the region's tail, and grow
+ * with the memory already mapped for their chain so the region count stays
+ * logarithmic in the chain size.
+ */
+static ARENA_CONSTINIT std::size_t S_min_region_size = Region::S_capacity;
+static ARENA_CONSTINIT std::size_t S_max_region_size = std::size_t (16) << 20;
 
-static struct RegionDeleter
+struct RegionSizer
 {
-  RegionDeleter ()
+  enum : std::size_t
+  {
+    S_buckets = 64,
+    // Halve the histogram once this many bytes were recorded.
+    S_decay_threshold = std::size_t (64) << 20,
+    // A typical allocation should waste at most 1/S_waste_ratio of a region.
+    S_waste_ratio = 32,
+    // New regions are at least 1/S_growth_ratio of the memory mapped for
+    // their chain.
+    S_growth_ratio = 4,
+  };
+
+  std::size_t histogram[S_buckets] {};
+  std::size_t histogram_total = 0;
+  std::size_t mapped = 0;
+
+  static std::size_t
+  bucket_of (std::size_t n)
+  {
+    std::size_t b = 0;
+    while (n >>= 1)
+      ++b;
+    return b;
+  }
+
+  void
+  record (std::size_t n)
   {
-    S_regions = new region_list ();
-    S_regions->reserve (4);
+    histogram[bucket_of (n)] += n;
+    histogram_total += n;
+    if (histogram_total >= S_decay_threshold)
+      {
+        histogram_total = 0;
+        for (auto &h : histogram)
+          histogram_total += (h /= 2);
+      }
   }
 
-  ~RegionDeleter ()
+  /// Upper bound of the bucket containing 90% of the recorded bytes.
+  std::size_t
+  typical_size () const
+  {
+    const std::size_t target = histogram_total - histogram_total / 10;
+    std::size_t seen = 0;
+    for (std::size_t b = 0; b < S_buckets - 1; ++b)
+      {
+        seen += histogram[b];
+        if (seen >= target && seen != 0)
+          return std::size_t (2) << b;
+      }
+    return 0;
+  }
+
+  /**
+   * @param n - bytes the region must hold
+   * @param chain_mapped - bytes mapped for the chain the region is added to
+   * @param size_limit - largest allocation of the chain's size class
+   */
+  std::size_t
+  region_capacity (std::size_t n, std::size_t chain_mapped,
+                   std::size_t size_limit) const
+  {
+    std::size_t cap = std::max (std::min (typical_size (), size_limit)
+                                * S_waste_ratio,
+                                chain_mapped / S_growth_ratio);
+    cap = std::min (std::max (cap, S_min_region_size), S_max_region_size);
+    cap = std::max (cap, n + 1);
+    return (cap + Region::S_capacity - 1) / Region::S_capacity * Region::S_capacity;
+  }
+};
+
+struct RetiredAllocation
+{
+  char *p;
+  std::size_t n;
+  void (*destroy) (char *, std::size_t);
+  std::uint64_t epoch;
+};
+
+// Unique across all frame pools and their resets.
+static ARENA_CONSTINIT std::atomic<std::uint64_t> S_frame_generation {0};
+
+/**
+ * Coroutine frames of an arena.  Each frame is preceded by a pointer to its
+ * pool and rounded up to a multiple of ‘S_granule’ bytes.  Threads keep
+ * freed frames of their current arena in a @ref FrameCache without any
+ * locking, and exchange them in batches with the free lists of the pool,
+ * guarded by its own mutex.  New frames are cut from chunks allocated from
+ * the arena, which are only released with the arena.
+ *
+ * Pools are reference counted by their arena and the caches using them, so
+ * a cache can tell from the generation whether its frames are still valid.
+ */
+struct FramePool
+{
+  enum : std::size_t
+  {
+    S_header = alignof (std::max_align_t),
+    S_granule = 64,
+    S_sizes = 16,
+    S_batch = 1024,
+    S_chunk = 64 * 1024,
+  };
+
+  struct FreeFrame
+  {
+    FreeFrame *next;
+  };
+
+  std::mutex mutex {};
+  FreeFrame *free[S_sizes] {};
+  char *top = nullptr;
+  char *end = nullptr;
+  // Changes when the arena releases the memory of the frames.
+  std::atomic<std::uint64_t> generation {++S_frame_generation};
+  std::atomic<unsigned> refs {1};
+};
+
+static void
+unref_frame_pool (FramePool *pool)
+{
+  if (pool->refs.fetch_sub (1, std::memory_order_acq_rel) == 1)
+    delete pool;
+}
+
+struct FramePoolRelease
+{
+  void operator() (FramePool *pool) const { unref_frame_pool (pool); }
+};
+
+using frame_pool_ptr = std::unique_ptr<FramePool, FramePoolRelease>;
+
+struct ArenaState
+{
+  region_list regions {};
+  RegionSizer sizer {};
+  MemoryProvider *provider = &S_system_memory.provider;
+  // Child arenas borrow free regions from their parent.
+  ArenaState *parent = nullptr;
+  // Index of the region last allocated from, per node, temperature and size
+  // class.
+  std::size_t active[S_node_hints][S_temperatures][S_size_classes] {};
+  // Most recently registered destructor.
+  DestructorEntry *destructors = nullptr;
+  // Allocations retired with ‘epoch::retire’, in epoch order.
+  std::vector<RetiredAllocation> retired {};
+  // Region the next ‘reserved_left’ bytes allocated by ‘reserved_by’ are
+  // allocated from.
+  const char *reserved = nullptr;
+  std::size_t reserved_index = 0;
+  std::size_t reserved_left = 0;
+  std::thread::id reserved_by {};
+  // Coroutine frames, and the pools of arenas spliced into this one, which
+  // their frames are still freed to.
+  frame_pool_ptr frames {new FramePool ()};
+  std::vector<frame_pool_ptr> spliced_frames {};
+  // All live arenas are linked together, guarded by S_mutex.
+  ArenaState *prev = nullptr;
+  ArenaState *next = nullptr;
+};
+
+static ARENA_CONSTINIT ArenaState *S_arenas {};
+// Created on first use in static storage and never destroyed.
+static ARENA_CONSTINIT ArenaState *S_default_arena {};
+alignas (ArenaState) static unsigned char
+  S_default_arena_storage[sizeof (ArenaState)];
+static ARENA_CONSTINIT thread_local ArenaState *S_current_arena {};
+static ARENA_CONSTINIT thread_local Temperature S_temperature
+  = Temperature::normal;
+
+static void
+link_arena (ArenaState *arena)
+{
+  arena->next = S_arenas;
+  if (S_arenas)
+    S_arenas->prev = arena;
+  S_arenas = arena;
+}
+
+static void
+unlink_arena (ArenaState *arena)
+{
+  if (arena->prev)
+    arena->prev->next = arena->next;
+  else
+    S_arenas = arena->next;
+  if (arena->next)
+    arena->next->prev = arena->prev;
+  arena->prev = arena->next = nullptr;
+}
+
+/**
+ * Runs the destructors registered with the arena, newest first.  Must be
+ * called without holding the lock since destructors may deallocate.
+ */
+static void
+run_destructors (ArenaState &arena)
+{
+  for (;;)
+    {
+      DestructorEntry *entry;
+      {
+        const Lock lock {};
+        entry = arena.destructors;
+        if (entry == nullptr)
+          return;
+        arena.destructors = entry->prev;
+      }
+      entry->destroy (entry);
+    }
+}
+
+static void stop_scavenger ();
+
+/**
+ * Stops the scavenger and destroys the objects created in the default arena
+ * at exit.  The default arena itself is never destroyed and its regions stay
+ * mapped until the process ends, so containers destroyed later during static
+ * destruction can still deallocate.
+ */
+static ARENA_CONSTINIT struct ExitHook
+{
+  ~ExitHook ()
   {
-    for (auto &r : *S_regions)
-      r.destruct ();
-    delete S_regions;
-    S_regions = nullptr;
+    stop_scavenger ();
+    if (S_default_arena)
+      run_destructors (*S_default_arena);
   }
-} const S_region_deleter {};
+} S_exit_hook {};
+
+/// Returns the default arena, creating it on first use.
+static ArenaState &
+default_arena ()
+{
+  if (S_default_arena == nullptr)
+    {
+      S_default_arena = ::new (static_cast<void *> (S_default_arena_storage))
+        ArenaState ();
+      link_arena (S_default_arena);
+    }
+  return *S_default_arena;
+}
+
+static inline ArenaState &
+current_arena ()
+{
+  return S_current_arena ? *S_current_arena : default_arena ();
+}
 
-static std::mutex S_mutex {};
+static ARENA_CONSTINIT std::mutex S_mutex {};
 
 Lock::Lock ()
 {
@@ -131,11 +527,20 @@ Lock::~Lock ()
   S_mutex.unlock ();
 }
 
+/// Releases S_mutex, held by the caller, for its lifetime.
+struct Unlock
+{
+  Unlock () { S_mutex.unlock (); }
+  ~Unlock () { S_mutex.lock (); }
+  Unlock (const Unlock &) = delete;
+  Unlock &operator= (const Unlock &) = delete;
+};
+
 static region_iterator
-find_region_containing (const char *p)
+find_region_containing (ArenaState &arena, const char *p)
 {
-  const auto end = S_regions->end ();
-  for (auto it = S_regions->begin (); it != end; ++it)
+  const auto end = arena.regions.end ();
+  for (auto it = arena.regions.begin (); it != end; ++it)
     {
       if (p >= it->data () && p < it->top ())
         return it;
@@ -143,6 +548,30 @@ find_region_containing (const char *p)
   return end;
 }
 
+/**
+ * Finds the arena and region containing ‘p’, looking at the current arena
+ * first since memory is usually freed where it was allocated.
+ *
+ * @return The owning arena, or a null pointer if ‘p’ is not arena memory
+ */
+static ArenaState *
+find_owner (const char *p, region_iterator &region)
+{
+  ArenaState *const current = &current_arena ();
+  region = find_region_containing (*current, p);
+  if (region != current->regions.end ())
+    return current;
+  for (ArenaState *arena = S_arenas; arena; arena = arena->next)
+    {
+      if (arena == current)
+        continue;
+      region = find_region_containing (*arena, p);
+      if (region != arena->regions.end ())
+        return arena;
+    }
+  return nullptr;
+}
+
 static inline std::ptrdiff_t
 alignment_offset (const char *ptr, std::size_t alignment)
 {
@@ -151,57 +580,601 @@ alignment_offset (const char *ptr, std::size_t alignment)
 }
 
 static inline bool
-fits (const region_iterator region, std::size_t n, std::size_t alignment)
+fits (const region_iterator region, std::size_t n, std::size_t alignment,
+      Temperature temperature, unsigned size_class, int node)
 {
+  if (region->temperature () != temperature
+      || region->size_class () != size_class
+      || region->purging ()
+      || (node != Region::S_any_node && region->node () != node))
+    return false;
   n += alignment_offset (region->top (), alignment);
   return region->top () + n < region->end ();
 }
 
+static inline std::size_t &
+active_index (ArenaState &arena, Temperature temperature, unsigned size_class,
+              int node)
+{
+  const unsigned hint = node < 0 ? 0 : node % S_node_hints;
+  return arena.active[hint][static_cast<unsigned> (temperature)][size_class];
+}
+
 static region_iterator
-find_region_fitting (std::size_t n, std::size_t alignment, const char *hint)
+find_region_fitting (ArenaState &arena, std::size_t n, std::size_t alignment,
+                     Temperature temperature, unsigned size_class, int node,
+                     const char *hint)
 {
-  const auto end = S_regions->end ();
+  const auto end = arena.regions.end ();
   region_iterator it;
 
   if (hint)
     {
-      it = find_region_containing (hint);
-      if ((it != end) && fits (it, n, alignment))
+      it = find_region_containing (arena, hint);
+      if ((it != end) && fits (it, n, alignment, temperature, size_class, node))
+        return it;
+    }
+
+  // The index may be stale after regions were removed, but ‘fits’ still
+  // checks the region belongs to the chain.
+  const std::size_t active
+    = active_index (arena, temperature, size_class, node);
+  if (active < arena.regions.size ())
+    {
+      it = arena.regions.begin () + active;
+      if (fits (it, n, alignment, temperature, size_class, node))
         return it;
     }
 
-  for (it = S_regions->begin (); it != end; ++it)
+  for (it = arena.regions.begin (); it != end; ++it)
     {
-      if (fits (it, n, alignment))
+      if (fits (it, n, alignment, temperature, size_class, node))
         return it;
     }
   return end;
 }
 
+using stack_trace = std::vector<void *>;
+
+struct ProfileBucket
+{
+  std::size_t live_count = 0;
+  std::size_t live_bytes = 0;
+  std::size_t total_count = 0;
+  std::size_t total_bytes = 0;
+};
+
+struct ProfileSample
+{
+  ProfileBucket *bucket;
+  std::size_t size;
+};
+
+struct Profiler
+{
+  enum : int { S_max_depth = 64 };
+
+  bool running = false;
+  std::size_t interval = 0;
+  std::ptrdiff_t until_sample = 0;
+  std::minstd_rand rng {};
+  std::map<stack_trace, ProfileBucket> buckets {};
+  std::unordered_map<const char *, ProfileSample> samples {};
+
+  std::ptrdiff_t
+  next_sample_distance ()
+  {
+    std::exponential_distribution<double> dist (1.0 / interval);
+    return static_cast<std::ptrdiff_t> (dist (rng)) + 1;
+  }
+};
+
+// Created on first use and never destroyed so frees during static
+// destruction can still consult it.
+static ARENA_CONSTINIT Profiler *S_profiler {};
+
+static stack_trace
+capture_stack_trace ()
+{
+  void *frames[Profiler::S_max_depth];
+  int depth = 0;
+#if defined (_WIN32)
+  depth = CaptureStackBackTrace (0, Profiler::S_max_depth, frames, NULL);
+#elif defined (ARENA_HAS_BACKTRACE)
+  depth = backtrace (frames, Profiler::S_max_depth);
+#endif
+  return stack_trace (frames, frames + depth);
+}
+
+static void
+profiler_note_allocate (const char *p, std::size_t n)
+{
+  Profiler &prof = *S_profiler;
+  prof.until_sample -= n;
+  if (prof.until_sample > 0)
+    return;
+  prof.until_sample = prof.next_sample_distance ();
+  ProfileBucket &bucket = prof.buckets[capture_stack_trace ()];
+  ++bucket.live_count;
+  bucket.live_bytes += n;
+  ++bucket.total_count;
+  bucket.total_bytes += n;
+  prof.samples[p] = { &bucket, n };
+}
+
+static void
+profiler_note_deallocate (const char *p)
+{
+  const auto it = S_profiler->samples.find (p);
+  if (it == S_profiler->samples.end ())
+    return;
+  --it->second.bucket->live_count;
+  it->second.bucket->live_bytes -= it->second.size;
+  S_profiler->samples.erase (it);
+}
+
+static void
+profiler_note_resize (const char *p, std::size_t to_n)
+{
+  const auto it = S_profiler->samples.find (p);
+  if (it == S_profiler->samples.end ())
+    return;
+  it->second.bucket->live_bytes += to_n - it->second.size;
+  it->second.size = to_n;
+}
+
+static inline bool
+profiler_tracking ()
+{
+  return S_profiler && !S_profiler->samples.empty ();
+}
+
+/// Drops the samples of memory released in bulk with its arena.
+static void
+profiler_forget (ArenaState &arena)
+{
+  auto &samples = S_profiler->samples;
+  for (auto it = samples.begin (); it != samples.end ();)
+    {
+      if (find_region_containing (arena, it->first) == arena.regions.end ())
+        {
+          ++it;
+          continue;
+        }
+      --it->second.bucket->live_count;
+      it->second.bucket->live_bytes -= it->second.size;
+      it = samples.erase (it);
+    }
+}
+
+struct Prefault
+{
+  std::size_t min_size = 0;
+  unsigned threads = 1;
+};
+
+static ARENA_CONSTINIT Prefault S_prefault {};
+
+// Guarded by S_mutex.
+static ARENA_CONSTINIT struct Counters
+{
+  std::size_t prefaulted_regions = 0;
+  std::size_t prefaulted_bytes = 0;
+  std::uint64_t prefault_ns = 0;
+  std::uint64_t last_prefault_ns = 0;
+} S_counters {};
+
+static void
+prefault_range (char *p, std::size_t n)
+{
+#ifdef __linux__
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+  // Not supported before Linux 5.14.
+  if (madvise (p, n, MADV_POPULATE_WRITE) == 0)
+    return;
+#endif
+  for (std::size_t i = 0; i < n; i += Region::S_capacity)
+    static_cast<volatile char *> (p)[i] = 0;
+}
+
+/// A part of a region to pre-fault.
+struct PrefaultTask
+{
+  char *p;
+  std::size_t n;
+  // Tasks of the same region not yet done.
+  std::size_t *remaining;
+};
+
+/**
+ * Threads pre-faulting parts of new regions, started by ‘set_prefault’ and
+ * never stopped.
+ */
+struct PrefaultWorkers
+{
+  std::mutex mutex {};
+  std::condition_variable wake {};
+  std::condition_variable done {};
+  std::vector<PrefaultTask> tasks {};
+  unsigned threads = 0;
+};
+
+// Created on first use and never destroyed, guarded by S_mutex.
+static ARENA_CONSTINIT PrefaultWorkers *S_prefault_workers {};
+
+/// Runs the last queued task with ‘lock’ released.
+static void
+run_prefault_task (PrefaultWorkers &workers,
+                   std::unique_lock<std::mutex> &lock)
+{
+  const PrefaultTask task = workers.tasks.back ();
+  workers.tasks.pop_back ();
+  lock.unlock ();
+  prefault_range (task.p, task.n);
+  lock.lock ();
+  if (--*task.remaining == 0)
+    workers.done.notify_all ();
+}
+
+static void
+prefault_worker (PrefaultWorkers &workers)
+{
+  std::unique_lock<std::mutex> lock (workers.mutex);
+  for (;;)
+    {
+      workers.wake.wait (lock, [&] { return !workers.tasks.empty (); });
+      run_prefault_task (workers, lock);
+    }
+}
+
+/**
+ * Faults in all pages of a new region, split between the calling thread and
+ * the workers.  Called without S_mutex held.
+ *
+ * @param threads - number of threads to use, including the calling thread
+ * @return the time it took in nanoseconds
+ */
+static std::uint64_t
+prefault (Region &r, PrefaultWorkers *workers, unsigned threads)
+{
+  const auto start = idle_clock::now ();
+  const std::size_t pages = r.capacity () / Region::S_capacity;
+  if (workers == nullptr)
+    threads = 1;
+  threads = std::min<std::size_t> (threads, std::max<std::size_t> (pages, 1));
+  const std::size_t chunk = (pages + threads - 1) / threads * Region::S_capacity;
+  if (threads > 1)
+    {
+      std::size_t remaining = 0;
+      std::unique_lock<std::mutex> lock (workers->mutex);
+      for (std::size_t offset = 0; offset < r.capacity (); offset += chunk)
+        {
+          workers->tasks.push_back ({r.data () + offset,
+                                     std::min (chunk, r.capacity () - offset),
+                                     &remaining});
+          ++remaining;
+        }
+      workers->wake.notify_all ();
+      // Help with the queued tasks until those of this region are done.
+      while (remaining)
+        if (!workers->tasks.empty ())
+          run_prefault_task (*workers, lock);
+        else
+          workers->done.wait (lock);
+    }
+  else
+    prefault_range (r.data (), r.capacity ());
+  const std::chrono::nanoseconds elapsed = idle_clock::now () - start;
+  return elapsed.count ();
+}
+
+struct Numa
+{
+  NumaPolicy policy = NumaPolicy::none;
+  unsigned node = 0;
+};
+
+static ARENA_CONSTINIT Numa S_numa {};
+
+static unsigned
+count_numa_nodes ()
+{
+#ifdef __linux__
+  // A list of node ranges like ‘0-1’.
+  std::FILE *f = std::fopen ("/sys/devices/system/node/possible", "r");
+  if (f == nullptr)
+    return 1;
+  unsigned last = 0, node;
+  while (std::fscanf (f, "%u", &node) == 1)
+    {
+      last = std::max (last, node);
+      if (std::fgetc (f) == EOF)
+        break;
+    }
+  std::fclose (f);
+  return last + 1;
+#else
+  return 1;
+#endif
+}
+
+static int
+current_node ()
+{
+#ifdef __linux__
+  unsigned cpu = 0, node = 0;
+#ifdef ARENA_HAS_GETCPU
+  // Served by the vDSO.
+  if (getcpu (&cpu, &node) == 0)
+    return node;
+#else
+  if (syscall (SYS_getcpu, &cpu, &node, nullptr) == 0)
+    return node;
+#endif
+#endif
+  return 0;
+}
+
+/// Returns the node new allocations are placed on, or any node.
+static int
+allocation_node ()
+{
+  switch (S_numa.policy)
+    {
+    case NumaPolicy::local:
+      return current_node ();
+    case NumaPolicy::node:
+      return S_numa.node;
+    default:
+      return Region::S_any_node;
+    }
+}
+
+/**
+ * Binds the pages of a new region to ‘node’, or interleaves them across all
+ * nodes, before they are first touched.
+ *
+ * @return false if the kernel does not support ‘mbind’
+ */
+static bool
+place_region ([[maybe_unused]] Region &r, [[maybe_unused]] int node,
+              [[maybe_unused]] NumaPolicy policy)
+{
+#ifdef __linux__
+  if (policy == NumaPolicy::none)
+    return true;
+  enum { MPOL_PREFERRED = 1, MPOL_INTERLEAVE = 3 };
+  constexpr unsigned bits = sizeof (unsigned long) * 8;
+  std::vector<unsigned long> mask ((numa_nodes () + bits - 1) / bits);
+  int mode = MPOL_PREFERRED;
+  if (node == Region::S_any_node)
+    {
+      mode = MPOL_INTERLEAVE;
+      for (unsigned i = 0; i < numa_nodes (); ++i)
+        mask[i / bits] |= 1ul << i % bits;
+    }
+  else if (static_cast<unsigned> (node) < numa_nodes ())
+    mask[node / bits] = 1ul << node % bits;
+  // The kernel expects the number of bits plus one.
+  if (syscall (SYS_mbind, r.data (), r.capacity (), mode, mask.data (),
+               mask.size () * bits + 1, 0)
+      != 0)
+    return false;
+  r.place (node);
+#endif
+  return true;
+}
+
+/**
+ * Finds an empty region of at least ‘min_capacity’ bytes on ‘node’ in any
+ * chain.
+ */
+static region_iterator
+find_empty_region (ArenaState &arena, std::size_t min_capacity, int node)
+{
+  return std::find_if (arena.regions.begin (), arena.regions.end (),
+                       [&] (Region &r) {
+                         return (r.empty () && r.capacity () >= min_capacity
+                                 && r.data () != arena.reserved
+                                 && !r.purging ()
+                                 && (node == Region::S_any_node
+                                     || r.node () == node));
+                       });
+}
+
+static void
+move_region (ArenaState &from, region_iterator it, ArenaState &to)
+{
+  from.sizer.mapped -= it->capacity ();
+  to.sizer.mapped += it->capacity ();
+  to.regions.push_back (std::move (*it));
+  from.regions.erase (it);
+}
+
+/**
+ * Creates a region and faults in its pages with S_mutex released, so other
+ * threads keep allocating meanwhile.  The region is only added to the arena
+ * once it is ready.  Other memory providers need not be thread-safe, so only
+ * the system memory is also mapped without the lock.
+ */
+static region_iterator
+create_prefaulted_region (ArenaState &arena, std::size_t capacity,
+                          Temperature temperature, unsigned size_class,
+                          int node)
+{
+  MemoryProvider &provider = *arena.provider;
+  const bool system = &provider == &S_system_memory.provider;
+  const NumaPolicy policy = S_numa.policy;
+  PrefaultWorkers *const workers = S_prefault_workers;
+  const unsigned threads = S_prefault.threads;
+  std::optional<Region> region;
+  if (!system)
+    region.emplace (capacity, provider, temperature, size_class);
+  bool placed = true;
+  std::uint64_t ns;
+  {
+    const Unlock unlock {};
+    if (system)
+      {
+        region.emplace (capacity, provider, temperature, size_class);
+        placed = place_region (*region, node, policy);
+      }
+    ns = prefault (*region, workers, threads);
+  }
+  if (!placed)
+    S_numa.policy = NumaPolicy::none;
+  ++S_counters.prefaulted_regions;
+  S_counters.prefaulted_bytes += capacity;
+  S_counters.last_prefault_ns = ns;
+  S_counters.prefault_ns += ns;
+  arena.regions.push_back (std::move (*region));
+  arena.sizer.mapped += capacity;
+  return std::prev (arena.regions.end ());
+}
+
+/**
+ * Provides a region for a new chain: an empty region of the arena itself,
+ * a free region borrowed from one of its ancestors, or a newly created one.
+ *
+ * @param capacity - capacity of a newly created region
+ * @param min_capacity - smallest capacity of a reused region
+ */
+static region_iterator
+create_region (ArenaState &arena, std::size_t capacity,
+               std::size_t min_capacity, Temperature temperature,
+               unsigned size_class, int node)
+{
+  auto it = find_empty_region (arena, min_capacity, node);
+  for (ArenaState *parent = arena.parent;
+       parent && it == arena.regions.end (); parent = parent->parent)
+    {
+      const auto borrowed = find_empty_region (*parent, min_capacity, node);
+      if (borrowed == parent->regions.end ())
+        continue;
+      move_region (*parent, borrowed, arena);
+      it = std::prev (arena.regions.end ());
+    }
+  if (it != arena.regions.end ())
+    {
+      it->retag (temperature, size_class);
+      return it;
+    }
+
+  if (S_prefault.min_size && capacity >= S_prefault.min_size)
+    return create_prefaulted_region (arena, capacity, temperature, size_class,
+                                     node);
+  arena.regions.emplace_back (capacity, *arena.provider, temperature,
+                              size_class);
+  arena.sizer.mapped += capacity;
+  if (arena.provider == &S_system_memory.provider
+      && !place_region (arena.regions.back (), node, S_numa.policy))
+    // Fall back to first-touch placement for good.
+    S_numa.policy = NumaPolicy::none;
+  return std::prev (arena.regions.end ());
+}
+
+/**
+ * Returns the bytes mapped for a chain, so its regions grow with the chain
+ * rather than with the whole arena.
+ */
+static std::size_t
+chain_mapped (const ArenaState &arena, Temperature temperature,
+              unsigned size_class, int node)
+{
+  std::size_t result = 0;
+  for (const auto &r : arena.regions)
+    if (r.temperature () == temperature && r.size_class () == size_class
+        && (node == Region::S_any_node || r.node () == node))
+      result += r.capacity ();
+  return result;
+}
+
+static void
+clear_reservation (ArenaState &arena)
+{
+  arena.reserved = nullptr;
+  arena.reserved_left = 0;
+}
+
+/**
+ * Returns the reserved region if the allocation fits the reservation, and
+ * ends the reservation otherwise.
+ */
+static region_iterator
+find_reserved_region (ArenaState &arena, std::size_t n, std::size_t alignment)
+{
+  const auto end = arena.regions.end ();
+  region_iterator it = end;
+  // The index is stale if regions before it were removed.
+  if (arena.reserved_index < arena.regions.size ()
+      && arena.regions[arena.reserved_index].data () == arena.reserved)
+    it = arena.regions.begin () + arena.reserved_index;
+  else
+    it = std::find_if (arena.regions.begin (), end, [&] (Region &r) {
+      return r.data () == arena.reserved;
+    });
+  if (it != end)
+    {
+      const std::size_t needed = n + alignment_offset (it->top (), alignment);
+      // Alignment padding is not counted, the region has room for it.
+      if (n <= arena.reserved_left && it->top () + needed < it->end ())
+        {
+          arena.reserved_index = it - arena.regions.begin ();
+          arena.reserved_left -= n;
+          return it;
+        }
+    }
+  clear_reservation (arena);
+  return end;
+}
+
 char *
 allocate (std::size_t n, std::size_t alignment, const char *hint)
 {
-  auto it = find_region_fitting (n, alignment, hint);
-  if (it == S_regions->end ())
+  ArenaState &arena = current_arena ();
+  arena.sizer.record (n);
+  region_iterator it = arena.regions.end ();
+  // Other threads scoped into the arena don't use up the reservation.
+  if (arena.reserved_left && arena.reserved_by == std::this_thread::get_id ())
+    it = find_reserved_region (arena, n, alignment);
+  if (it == arena.regions.end ())
     {
-      S_regions->emplace_back (n);
-      it = std::prev (S_regions->end ());
+      const Temperature temperature = S_temperature;
+      const unsigned size_class = size_class_of (n, alignment);
+      const int node = allocation_node ();
+      it = find_region_fitting (arena, n, alignment, temperature, size_class,
+                                node, hint);
+      if (it == arena.regions.end ())
+        {
+          const std::size_t capacity = arena.sizer.region_capacity
+            (n + alignment,
+             chain_mapped (arena, temperature, size_class, node),
+             S_size_limits[size_class / S_alignment_classes]);
+          it = create_region (arena, capacity, n + alignment + 1, temperature,
+                              size_class, node);
+        }
+      active_index (arena, temperature, size_class, node)
+        = it - arena.regions.begin ();
     }
   it->resize (alignment_offset (it->top (), alignment));
   const auto r = it->top ();
   it->resize (n);
   it->ref ();
+  if (S_profiler && S_profiler->running)
+    profiler_note_allocate (r, n);
   return r;
 }
 
 void
 deallocate (char *p, std::size_t n)
 {
-  if (S_regions == nullptr)
-    return;
-  const auto it = find_region_containing (p);
-  if (it == S_regions->end ())
+  region_iterator it;
+  if (find_owner (p, it) == nullptr)
     return;
+  if (profiler_tracking ())
+    profiler_note_deallocate (p);
   it->unref ();
   if (it->unused ())
     it->clear ();
@@ -209,26 +1182,57 @@ deallocate (char *p, std::size_t n)
     it->resize (0ll - n);
 }
 
-char *
-reallocate (char *p, std::size_t from_n, std::size_t to_n,
-            std::size_t alignment, const char *hint)
+/// Resizes the allocation if it is the last one in its region.
+static bool
+resize_in_place (region_iterator it, char *p, std::size_t from_n,
+                 std::size_t to_n)
 {
-  if (p == nullptr)
-    return allocate (to_n, alignment, hint);
-  const auto it = find_region_containing (p);
-  if (it == S_regions->end ())
-    return nullptr;
+  const std::ptrdiff_t diff = to_n - from_n;
+  if (it->top () - from_n != p || it->top () + diff >= it->end ())
+    return false;
+  it->resize (diff);
+  if (profiler_tracking ())
+    profiler_note_resize (p, to_n);
+  return true;
+}
+
+bool
+resize (char *p, std::size_t from_n, std::size_t to_n)
+{
+  region_iterator it;
+  if (p == nullptr || to_n == 0 || find_owner (p, it) == nullptr)
+    return false;
+  return resize_in_place (it, p, from_n, to_n);
+}
+
+std::size_t
+max_size_in_place (const char *p, std::size_t n)
+{
+  region_iterator it;
+  if (p == nullptr || find_owner (p, it) == nullptr)
+    return n;
+  if (it->top () - n != p)
+    return n;
+  // ‘resize_in_place’ keeps the top strictly below the end.
+  return it->end () - p - 1;
+}
+
+char *
+reallocate (char *p, std::size_t from_n, std::size_t to_n,
+            std::size_t alignment, const char *hint)
+{
+  if (p == nullptr)
+    return allocate (to_n, alignment, hint);
+  region_iterator it;
+  if (find_owner (p, it) == nullptr)
+    return nullptr;
   if (to_n == 0)
     {
       deallocate (p, from_n);
       return nullptr;
     }
-  const std::ptrdiff_t diff = to_n - from_n;
-  if (it->top () - from_n == p && it->top () + diff < it->end ())
-    {
-      it->resize (diff);
-      return p;
-    }
+  if (resize_in_place (it, p, from_n, to_n))
+    return p;
   if (to_n <= from_n)
     return p;
   char *const new_p = allocate (to_n, alignment, hint);
@@ -237,12 +1241,1121 @@ reallocate (char *p, std::size_t from_n, std::size_t to_n,
   return new_p;
 }
 
+struct ReaderSlot
+{
+  // The epoch observed by the reader, 0 if outside a critical section.
+  std::atomic<std::uint64_t> epoch {0};
+  std::atomic<bool> in_use {true};
+  ReaderSlot *next = nullptr;
+};
+
+static ARENA_CONSTINIT std::atomic<std::uint64_t> S_epoch {1};
+static ARENA_CONSTINIT std::atomic<ReaderSlot *> S_reader_slots {};
+// Retired allocations in all arenas, guarded by S_mutex.
+static ARENA_CONSTINIT std::size_t S_retired_count = 0;
+// Batches taken for reclamation but not yet deallocated, by all threads and
+// by the calling thread, guarded by S_mutex.
+static ARENA_CONSTINIT std::size_t S_reclaiming = 0;
+static ARENA_CONSTINIT thread_local std::size_t S_own_reclaiming = 0;
+
+static thread_local struct ReaderHandle
+{
+  ReaderSlot *slot = nullptr;
+  unsigned depth = 0;
+
+  ~ReaderHandle ()
+  {
+    if (slot == nullptr)
+      return;
+    slot->epoch.store (0, std::memory_order_release);
+    slot->in_use.store (false, std::memory_order_release);
+  }
+} S_reader {};
+
+static ReaderSlot *
+acquire_reader_slot ()
+{
+  for (auto slot = S_reader_slots.load (std::memory_order_acquire);
+       slot != nullptr; slot = slot->next)
+    {
+      bool expected = false;
+      if (slot->in_use.compare_exchange_strong (expected, true))
+        return slot;
+    }
+  // Slots are never freed so concurrent scans need no protection.
+  auto slot = new ReaderSlot ();
+  slot->next = S_reader_slots.load (std::memory_order_relaxed);
+  while (!S_reader_slots.compare_exchange_weak (slot->next, slot))
+    ;
+  return slot;
+}
+
+/// Advances the global epoch if all active readers have observed it.
+static void
+try_advance_epoch ()
+{
+  const auto epoch = S_epoch.load ();
+  for (auto slot = S_reader_slots.load (std::memory_order_acquire);
+       slot != nullptr; slot = slot->next)
+    {
+      const auto observed = slot->epoch.load ();
+      if (observed != 0 && observed != epoch)
+        return;
+    }
+  auto expected = epoch;
+  S_epoch.compare_exchange_strong (expected, epoch + 1);
+}
+
+/**
+ * Removes the retired allocations no reader can see anymore, of ‘only’ or of
+ * all arenas.  A non-empty result must be passed to @ref reclaim().
+ */
+static std::vector<RetiredAllocation>
+take_reclaimable (ArenaState *only)
+{
+  std::vector<RetiredAllocation> result;
+  if (S_retired_count == 0)
+    return result;
+  try_advance_epoch ();
+  // Memory retired in epoch ‘e’ may be seen by readers in ‘e’ and ‘e + 1’.
+  const auto safe = S_epoch.load () - 2;
+  const auto take = [&] (ArenaState &arena) {
+    auto &retired = arena.retired;
+    const auto end = std::find_if (retired.begin (), retired.end (),
+                                   [safe] (const RetiredAllocation &r) {
+                                     return r.epoch > safe;
+                                   });
+    result.insert (result.end (), retired.begin (), end);
+    retired.erase (retired.begin (), end);
+  };
+  if (only)
+    take (*only);
+  else
+    for (ArenaState *arena = S_arenas; arena; arena = arena->next)
+      take (*arena);
+  S_retired_count -= result.size ();
+  if (!result.empty ())
+    {
+      ++S_reclaiming;
+      ++S_own_reclaiming;
+    }
+  return result;
+}
+
+/**
+ * Destroys the allocations, then deallocates them under one lock.  Must be
+ * called without holding the lock.
+ */
+static std::size_t
+reclaim (const std::vector<RetiredAllocation> &retired)
+{
+  if (retired.empty ())
+    return 0;
+  for (const auto &r : retired)
+    if (r.destroy)
+      r.destroy (r.p, r.n);
+  const Lock lock {};
+  for (const auto &r : retired)
+    deallocate (r.p, r.n);
+  --S_reclaiming;
+  --S_own_reclaiming;
+  return retired.size ();
+}
+
+/**
+ * Reclaims all memory retired in ‘arena’, waiting for readers to leave their
+ * critical sections and for other threads to finish reclaiming, so its
+ * regions can be released.
+ */
+static void
+reclaim_retired (ArenaState &arena)
+{
+  for (;;)
+    {
+      std::vector<RetiredAllocation> reclaimable;
+      {
+        const Lock lock {};
+        if (arena.retired.empty () && S_reclaiming == S_own_reclaiming)
+          return;
+        reclaimable = take_reclaimable (&arena);
+      }
+      if (reclaimable.empty ())
+        std::this_thread::yield ();
+      reclaim (reclaimable);
+    }
+}
+
+void
+retire (char *p, std::size_t n, void (*destroy) (char *, std::size_t))
+{
+  enum : std::size_t { S_batch_size = 64 };
+  std::vector<RetiredAllocation> reclaimable;
+  {
+    const Lock lock {};
+    region_iterator region;
+    ArenaState *const owner = find_owner (p, region);
+    if (owner == nullptr)
+      return;
+    owner->retired.push_back ({ p, n, destroy, S_epoch.load () });
+    if (++S_retired_count % S_batch_size == 0)
+      reclaimable = take_reclaimable (nullptr);
+  }
+  reclaim (reclaimable);
+}
+
+struct Scavenger
+{
+  std::thread thread {};
+  std::mutex mutex {};
+  std::condition_variable wake {};
+  bool stopping = false;
+  idle_clock::duration decay {};
+  idle_clock::duration cold_after {};
+  bool cold_pageout = false;
+};
+
+// Created on first use and never destroyed.
+static ARENA_CONSTINIT Scavenger *S_scavenger {};
+
+/// Hints the operating system that the contents of the memory are not needed.
+static void
+advise_free (char *p, std::size_t n)
+{
+#ifdef _WIN32
+  VirtualAlloc (p, n, MEM_RESET, PAGE_READWRITE);
+#else
+#ifdef MADV_FREE
+  if (madvise (p, n, MADV_FREE) == 0)
+    return;
+#endif
+  madvise (p, n, MADV_DONTNEED);
+#endif
+}
+
+/**
+ * Hints the operating system to reclaim the memory before other memory under
+ * pressure, either by deactivating (‘MADV_COLD’) or by paging it out right
+ * away (‘MADV_PAGEOUT’).  The contents are preserved.
+ */
+static void
+advise_cold ([[maybe_unused]] char *p, [[maybe_unused]] std::size_t n,
+             [[maybe_unused]] bool pageout)
+{
+#ifdef __linux__
+#ifndef MADV_COLD
+#define MADV_COLD 20
+#endif
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+  // Not supported before Linux 5.4, failure is harmless.
+  madvise (p, n, pageout ? MADV_PAGEOUT : MADV_COLD);
+#endif
+}
+
+/**
+ * Purges regions that have been empty for some time: after ‘decay’ their
+ * pages are freed lazily, after twice that the region is unmapped.
+ *
+ * If ‘cold_after’ is non-zero, regions that have not been allocated from for
+ * that long are marked cold.
+ */
+static void
+scavenge (idle_clock::time_point now, idle_clock::duration decay,
+          idle_clock::duration cold_after, bool cold_pageout)
+{
+  region_list unmap;
+  std::vector<std::pair<char *, std::size_t>> purge;
+  std::vector<std::pair<char *, std::size_t>> cold;
+  {
+    const Lock lock {};
+    for (ArenaState *arena = S_arenas; arena; arena = arena->next)
+      {
+        auto &regions = arena->regions;
+        for (std::size_t i = 0; i < regions.size (); )
+          {
+            Region &r = regions[i];
+            if (r.data () == arena->reserved)
+              {
+                ++i;
+                continue;
+              }
+            if (r.allocations () != r.idle.seen_allocations)
+              {
+                r.idle.seen_allocations = r.allocations ();
+                r.idle.active_since = now;
+                r.idle.empty = r.idle.purged = r.idle.cold = false;
+              }
+            if (!r.empty ())
+              {
+                r.idle.empty = false;
+                if (cold_after.count () && !r.idle.cold
+                    && now - r.idle.active_since >= cold_after)
+                  {
+                    cold.emplace_back (r.data (), r.capacity ());
+                    r.idle.cold = true;
+                  }
+                ++i;
+                continue;
+              }
+            if (!r.idle.empty)
+              {
+                r.idle.empty = true;
+                r.idle.empty_since = now;
+              }
+            const auto age = now - r.idle.empty_since;
+            if (age >= 2 * decay)
+              {
+                arena->sizer.mapped -= r.capacity ();
+                // Other providers need not be thread-safe.
+                if (r.provider () == &S_system_memory.provider)
+                  unmap.push_back (std::move (r));
+                else
+                  r.destruct ();
+                regions.erase (regions.begin () + i);
+                continue;
+              }
+            if (age >= decay && !r.idle.purged)
+              {
+                if (r.provider () == &S_system_memory.provider)
+                  {
+                    r.set_purging (true);
+                    purge.emplace_back (r.data (), r.capacity ());
+                  }
+                r.idle.purged = true;
+              }
+            ++i;
+          }
+      }
+  }
+  // The regions are no longer reachable, unmap them without the lock held.
+  for (auto &r : unmap)
+    r.destruct ();
+  // Paging out may write to swap synchronously.  A region unmapped meanwhile
+  // only makes the hint apply to memory mapped in its place, which keeps its
+  // contents either way.
+  for (const auto &range : cold)
+    advise_cold (range.first, range.second, cold_pageout);
+  if (purge.empty ())
+    return;
+
+  // Allocation skips the marked regions, and arenas wait for the marks to be
+  // cleared before unmapping them, so their pages can be freed without the
+  // lock held.
+  for (const auto &range : purge)
+    advise_free (range.first, range.second);
+  const Lock lock {};
+  for (ArenaState *arena = S_arenas; arena; arena = arena->next)
+    for (auto &r : arena->regions)
+      r.set_purging (false);
+}
+
+/// Returns whether the scavenger is freeing the pages of a region of ‘arena’.
+static bool
+purging (const ArenaState &arena)
+{
+  return std::any_of (arena.regions.begin (), arena.regions.end (),
+                      [] (const Region &r) { return r.purging (); });
+}
+
+static void
+scavenger_main (Scavenger *scavenger)
+{
+  std::unique_lock<std::mutex> lock (scavenger->mutex);
+  while (!scavenger->stopping)
+    {
+      const auto decay = scavenger->decay;
+      const auto cold_after = scavenger->cold_after;
+      const auto cold_pageout = scavenger->cold_pageout;
+      auto period = decay;
+      if (cold_after.count ())
+        period = std::min (period, cold_after);
+      scavenger->wake.wait_for (lock, std::max (period / 4, idle_clock::duration
+                                                (std::chrono::milliseconds (1))));
+      if (scavenger->stopping)
+        break;
+      lock.unlock ();
+      scavenge (idle_clock::now (), decay, cold_after, cold_pageout);
+      lock.lock ();
+    }
+}
+
+static void
+stop_scavenger ()
+{
+  if (S_scavenger == nullptr)
+    return;
+  {
+    const std::lock_guard<std::mutex> lock (S_scavenger->mutex);
+    S_scavenger->stopping = true;
+  }
+  S_scavenger->wake.notify_all ();
+  if (S_scavenger->thread.joinable ())
+    S_scavenger->thread.join ();
+  S_scavenger->stopping = false;
+}
+
+// Guarded by S_mutex.
+static ARENA_CONSTINIT TypeRecord *S_type_records {};
+
+TypeRecord::TypeRecord (std::string_view name)
+  : statistics { name, 0, 0, 0, 0 }
+{
+  const Lock lock {};
+  next = S_type_records;
+  S_type_records = this;
+}
+
+/// Returns the size class of a coroutine frame of ‘n’ bytes with its header.
+static inline std::size_t
+frame_size_class (std::size_t n)
+{
+  return (n + FramePool::S_header - 1) / FramePool::S_granule;
+}
+
+/// Returns the current arena without taking the lock.
+static ArenaState &
+frame_arena ()
+{
+  if (S_current_arena)
+    return *S_current_arena;
+  // The default arena is never destroyed, so its address can be cached.
+  static ARENA_CONSTINIT thread_local ArenaState *default_state {};
+  if (default_state == nullptr)
+    {
+      const Lock lock {};
+      default_state = &default_arena ();
+    }
+  return *default_state;
+}
+
+/// Free frames of one pool owned by a thread.
+struct FrameCache
+{
+  enum : unsigned { S_max_freed = 32 };
+
+  FramePool *pool = nullptr;
+  std::uint64_t generation = 0;
+  FramePool::FreeFrame *free[FramePool::S_sizes] {};
+  // Frames freed into the cache and not reused yet, per size.
+  unsigned freed[FramePool::S_sizes] {};
+
+  bool
+  holds (FramePool &p) const
+  {
+    return (pool == &p
+            && generation == p.generation.load (std::memory_order_relaxed));
+  }
+
+  /// Gives the frames back to the pool, unless it was reset meanwhile.
+  void
+  detach ()
+  {
+    if (pool == nullptr)
+      return;
+    {
+      const std::lock_guard<std::mutex> lock (pool->mutex);
+      if (holds (*pool))
+        for (std::size_t size = 0; size < FramePool::S_sizes; ++size)
+          while (FramePool::FreeFrame *frame = free[size])
+            {
+              free[size] = frame->next;
+              frame->next = pool->free[size];
+              pool->free[size] = frame;
+            }
+    }
+    std::fill (std::begin (free), std::end (free), nullptr);
+    std::fill (std::begin (freed), std::end (freed), 0);
+    unref_frame_pool (std::exchange (pool, nullptr));
+  }
+
+  void
+  attach (FramePool &p)
+  {
+    detach ();
+    p.refs.fetch_add (1, std::memory_order_relaxed);
+    pool = &p;
+    generation = p.generation.load (std::memory_order_relaxed);
+  }
+
+  ~FrameCache () { detach (); }
+};
+
+static ARENA_CONSTINIT thread_local FrameCache S_frame_cache {};
+
+/**
+ * Takes all free frames of a size from the pool, or cuts a batch of new
+ * ones.
+ */
+static FramePool::FreeFrame *
+refill_frame_cache (FramePool &pool, std::size_t size)
+{
+  const std::lock_guard<std::mutex> lock (pool.mutex);
+  if (FramePool::FreeFrame *frames = pool.free[size])
+    {
+      pool.free[size] = nullptr;
+      return frames;
+    }
+  const std::size_t bytes = (size + 1) * FramePool::S_granule;
+  if (static_cast<std::size_t> (pool.end - pool.top) < bytes)
+    {
+      const Lock global {};
+      pool.top = allocate (FramePool::S_chunk, alignof (std::max_align_t),
+                           nullptr);
+      pool.end = pool.top + FramePool::S_chunk;
+    }
+  std::size_t count = std::max<std::size_t> (FramePool::S_batch / bytes, 1);
+  count = std::min<std::size_t> (count, (pool.end - pool.top) / bytes);
+  FramePool::FreeFrame *frames = nullptr;
+  for (std::size_t i = 0; i < count; ++i, pool.top += bytes)
+    frames = ::new (static_cast<void *> (pool.top))
+      FramePool::FreeFrame {frames};
+  return frames;
+}
+
+void *
+allocate_frame (std::size_t n)
+{
+  const std::size_t size = frame_size_class (n);
+  if (size >= FramePool::S_sizes)
+    return nullptr;
+  FramePool &pool = *frame_arena ().frames;
+  FrameCache &cache = S_frame_cache;
+  if (!cache.holds (pool))
+    cache.attach (pool);
+  FramePool::FreeFrame *frame = cache.free[size];
+  if (frame == nullptr)
+    frame = refill_frame_cache (pool, size);
+  cache.free[size] = frame->next;
+  if (cache.freed[size])
+    --cache.freed[size];
+  char *p = reinterpret_cast<char *> (frame);
+  *reinterpret_cast<FramePool **> (p) = &pool;
+  return p + FramePool::S_header;
+}
+
+bool
+deallocate_frame (void *frame, std::size_t n)
+{
+  const std::size_t size = frame_size_class (n);
+  if (size >= FramePool::S_sizes)
+    return false;
+  char *p = static_cast<char *> (frame) - FramePool::S_header;
+  FramePool &pool = **reinterpret_cast<FramePool **> (p);
+  FrameCache &cache = S_frame_cache;
+  // Caches are bounded, so threads only freeing frames don't pile them up.
+  if (cache.holds (pool) && cache.freed[size] < FrameCache::S_max_freed)
+    {
+      cache.free[size] = ::new (p) FramePool::FreeFrame {cache.free[size]};
+      ++cache.freed[size];
+      return true;
+    }
+  const std::lock_guard<std::mutex> lock (pool.mutex);
+  pool.free[size] = ::new (p) FramePool::FreeFrame {pool.free[size]};
+  return true;
+}
+
+/**
+ * Forgets all frames of the arena, whose memory is being released.  Caches
+ * of other threads notice the new generation and drop their frames.
+ */
+static void
+clear_frames (ArenaState &arena)
+{
+  FramePool &pool = *arena.frames;
+  std::fill (std::begin (pool.free), std::end (pool.free), nullptr);
+  pool.top = pool.end = nullptr;
+  pool.generation = ++S_frame_generation;
+  for (auto &spliced : arena.spliced_frames)
+    spliced->generation = ++S_frame_generation;
+  arena.spliced_frames.clear ();
+}
+
+// Guarded by S_mutex.
+static ARENA_CONSTINIT unsigned long long S_destructor_sequence = 0;
+
+void
+register_destructor (DestructorEntry *entry)
+{
+  ArenaState &arena = current_arena ();
+  entry->sequence = ++S_destructor_sequence;
+  entry->prev = arena.destructors;
+  arena.destructors = entry;
+}
+
+void
+reserve_contiguous (std::size_t n)
+{
+  ArenaState &arena = current_arena ();
+  // Leave room for alignment padding between the allocations.
+  std::size_t capacity = n + n / 16 + alignof (std::max_align_t);
+  capacity = ((capacity + Region::S_capacity - 1)
+              / Region::S_capacity * Region::S_capacity);
+  const auto it = create_region (arena, capacity, capacity, S_temperature,
+                                 S_reserved_class, allocation_node ());
+  arena.reserved = it->data ();
+  arena.reserved_index = it - arena.regions.begin ();
+  arena.reserved_left = n;
+  arena.reserved_by = std::this_thread::get_id ();
+}
+
 std::size_t
 default_region_size ()
 {
-  return Region::S_capacity;
+  const Lock lock {};
+  const auto &arena = current_arena ();
+  return arena.sizer.region_capacity (0, arena.sizer.mapped, SIZE_MAX);
 }
 
 } // namespace detail
 
+void
+set_region_size_bounds (std::size_t min_size, std::size_t max_size)
+{
+  const detail::Lock lock {};
+  detail::S_min_region_size
+    = std::max (min_size, std::size_t (detail::Region::S_capacity));
+  detail::S_max_region_size = std::max (max_size, detail::S_min_region_size);
+}
+
+MemoryProvider &
+system_memory ()
+{
+  return detail::S_system_memory.provider;
+}
+
+void
+set_memory_provider (MemoryProvider &provider)
+{
+  const detail::Lock lock {};
+  detail::default_arena ().provider = &provider;
+}
+
+BufferMemoryProvider::BufferMemoryProvider (void *buffer, std::size_t size)
+  : M_begin (static_cast<char *> (buffer))
+  , M_top (M_begin)
+  , M_end (M_begin + size)
+{
+}
+
+void *
+BufferMemoryProvider::allocate (std::size_t n)
+{
+  const std::size_t alignment = alignof (std::max_align_t);
+  n = (n + alignment - 1) / alignment * alignment;
+  if (static_cast<std::size_t> (M_end - M_top) < n)
+    return nullptr;
+  char *const p = M_top;
+  M_top += n;
+  return p;
+}
+
+void
+BufferMemoryProvider::deallocate (void *p, std::size_t n)
+{
+  const std::size_t alignment = alignof (std::max_align_t);
+  n = (n + alignment - 1) / alignment * alignment;
+  if (static_cast<char *> (p) + n == M_top)
+    M_top -= n;
+}
+
+std::size_t
+BufferMemoryProvider::used () const
+{
+  return M_top - M_begin;
+}
+
+void
+set_prefault (std::size_t min_size, unsigned threads)
+{
+  const detail::Lock lock {};
+  detail::S_prefault.min_size = min_size;
+  detail::S_prefault.threads = std::max (threads, 1u);
+  if (threads <= 1)
+    return;
+  if (detail::S_prefault_workers == nullptr)
+    detail::S_prefault_workers = new detail::PrefaultWorkers ();
+  auto &workers = *detail::S_prefault_workers;
+  for (; workers.threads < threads - 1; ++workers.threads)
+    std::thread (detail::prefault_worker, std::ref (workers)).detach ();
+}
+
+unsigned
+numa_nodes ()
+{
+  static const unsigned nodes = detail::count_numa_nodes ();
+  return nodes;
+}
+
+void
+set_numa_policy (NumaPolicy policy, unsigned node)
+{
+  const detail::Lock lock {};
+  detail::S_numa.policy = numa_nodes () > 1 ? policy : NumaPolicy::none;
+  if (policy == NumaPolicy::node && node >= numa_nodes ())
+    detail::S_numa.policy = NumaPolicy::none;
+  detail::S_numa.node = node;
+}
+
+Statistics
+statistics ()
+{
+  const detail::Lock lock {};
+  Statistics result {};
+  for (auto arena = detail::S_arenas; arena; arena = arena->next)
+    {
+      for (auto &r : arena->regions)
+        {
+          ++result.regions;
+          result.mapped_bytes += r.capacity ();
+          result.used_bytes += r.top () - r.data ();
+        }
+    }
+  result.prefaulted_regions = detail::S_counters.prefaulted_regions;
+  result.prefaulted_bytes = detail::S_counters.prefaulted_bytes;
+  result.prefault_ns = detail::S_counters.prefault_ns;
+  result.last_prefault_ns = detail::S_counters.last_prefault_ns;
+  return result;
+}
+
+string_builder::string_builder (string_builder &&other) noexcept
+  : M_data (std::exchange (other.M_data, nullptr))
+  , M_size (std::exchange (other.M_size, 0))
+  , M_capacity (std::exchange (other.M_capacity, 0))
+{
+}
+
+string_builder &
+string_builder::operator= (string_builder &&other) noexcept
+{
+  std::swap (M_data, other.M_data);
+  std::swap (M_size, other.M_size);
+  std::swap (M_capacity, other.M_capacity);
+  return *this;
+}
+
+string_builder::~string_builder ()
+{
+  // The buffer has room for the terminator.
+  Allocator<char> ().deallocate (M_data, M_capacity + 1);
+}
+
+void
+string_builder::reserve (std::size_t n)
+{
+  if (n <= M_capacity)
+    return;
+  M_data = Allocator<char> ().reallocate (M_data, M_data ? M_capacity + 1 : 0,
+                                          n + 1, M_data);
+  M_capacity = n;
+  M_data[M_size] = '\0';
+}
+
+void
+string_builder::clear ()
+{
+  M_size = 0;
+  if (M_data)
+    M_data[0] = '\0';
+}
+
+/// Makes room for ‘n’ more characters and returns where they go.
+char *
+string_builder::grow (std::size_t n)
+{
+  if (M_size + n > M_capacity)
+    reserve (std::max ({ M_size + n, M_capacity * 2, std::size_t (31) }));
+  return M_data + M_size;
+}
+
+string_builder &
+string_builder::append (const char *s, std::size_t n)
+{
+  std::memcpy (grow (n), s, n);
+  M_size += n;
+  M_data[M_size] = '\0';
+  return *this;
+}
+
+string_builder &
+string_builder::append (char c)
+{
+  *grow (1) = c;
+  M_data[++M_size] = '\0';
+  return *this;
+}
+
+string_builder &
+string_builder::append_signed (long long value)
+{
+  enum : std::size_t { S_max_digits = 20 };
+  char *const first = grow (S_max_digits);
+  M_size = std::to_chars (first, first + S_max_digits, value).ptr - M_data;
+  M_data[M_size] = '\0';
+  return *this;
+}
+
+string_builder &
+string_builder::append_unsigned (unsigned long long value)
+{
+  enum : std::size_t { S_max_digits = 20 };
+  char *const first = grow (S_max_digits);
+  M_size = std::to_chars (first, first + S_max_digits, value).ptr - M_data;
+  M_data[M_size] = '\0';
+  return *this;
+}
+
+string_builder &
+string_builder::append (double value)
+{
+  enum : std::size_t { S_max_chars = 32 };
+  char *const first = grow (S_max_chars);
+#if defined (__cpp_lib_to_chars)
+  M_size = std::to_chars (first, first + S_max_chars, value).ptr - M_data;
+#else
+  M_size += std::snprintf (first, S_max_chars, "%.17g", value);
+#endif
+  M_data[M_size] = '\0';
+  return *this;
+}
+
+std::size_t
+type_statistics (TypeStatistics *out, std::size_t max)
+{
+  const detail::Lock lock {};
+  std::size_t count = 0;
+  for (auto record = detail::S_type_records; record; record = record->next)
+    {
+      if (count < max)
+        out[count] = record->statistics;
+      ++count;
+    }
+  return count;
+}
+
+Arena::Arena (MemoryProvider &provider)
+  : M_state (new detail::ArenaState ())
+{
+  M_state->provider = &provider;
+  const detail::Lock lock {};
+  detail::link_arena (M_state);
+}
+
+Arena::Arena (child_of_t, Arena &parent)
+  : M_state (new detail::ArenaState ())
+{
+  M_state->provider = parent.M_state->provider;
+  M_state->parent = parent.M_state;
+  const detail::Lock lock {};
+  detail::link_arena (M_state);
+}
+
+Arena::~Arena ()
+{
+  reset ();
+  // The scavenger may still be freeing the pages of an empty region.
+  for (;; std::this_thread::yield ())
+    {
+      const detail::Lock lock {};
+      if (detail::purging (*M_state))
+        continue;
+      detail::unlink_arena (M_state);
+      for (auto &r : M_state->regions)
+        r.destruct ();
+      break;
+    }
+  delete M_state;
+}
+
+void
+Arena::reset ()
+{
+  detail::reclaim_retired (*M_state);
+  detail::run_destructors (*M_state);
+  const detail::Lock lock {};
+  detail::clear_reservation (*M_state);
+  detail::clear_frames (*M_state);
+  if (detail::profiler_tracking ())
+    detail::profiler_forget (*M_state);
+  for (auto &r : M_state->regions)
+    r.release ();
+  if (M_state->parent)
+    {
+      auto &regions = M_state->regions;
+      while (!regions.empty ())
+        detail::move_region (*M_state, std::prev (regions.end ()),
+                             *M_state->parent);
+    }
+}
+
+void
+Arena::splice (Arena &other)
+{
+  if (&other == this)
+    return;
+  const detail::Lock lock {};
+  auto &to = *M_state;
+  auto &from = *other.M_state;
+  to.regions.insert (to.regions.end (),
+                     std::make_move_iterator (from.regions.begin ()),
+                     std::make_move_iterator (from.regions.end ()));
+  from.regions.clear ();
+  detail::clear_reservation (from);
+  to.sizer.mapped += from.sizer.mapped;
+  from.sizer.mapped = 0;
+  // Both lists are in epoch order.
+  const auto middle = to.retired.insert (to.retired.end (),
+                                         from.retired.begin (),
+                                         from.retired.end ());
+  std::inplace_merge (to.retired.begin (), middle, to.retired.end (),
+                      [] (const detail::RetiredAllocation &a,
+                          const detail::RetiredAllocation &b) {
+                        return a.epoch < b.epoch;
+                      });
+  from.retired.clear ();
+  // Both lists are newest first, merge them so that all objects are still
+  // destroyed in the reverse order of their creation.
+  detail::DestructorEntry *a = to.destructors, *b = from.destructors;
+  detail::DestructorEntry **tail = &to.destructors;
+  while (a && b)
+    {
+      detail::DestructorEntry *&newer = a->sequence > b->sequence ? a : b;
+      *tail = newer;
+      tail = &newer->prev;
+      newer = newer->prev;
+    }
+  *tail = a ? a : b;
+  from.destructors = nullptr;
+  // Frames of the other arena still point to its pool.
+  to.spliced_frames.push_back (std::move (from.frames));
+  for (auto &pool : from.spliced_frames)
+    to.spliced_frames.push_back (std::move (pool));
+  from.spliced_frames.clear ();
+  from.frames.reset (new detail::FramePool ());
+}
+
+void
+Arena::advise_cold (bool pageout)
+{
+  std::vector<std::pair<char *, std::size_t>> ranges;
+  {
+    const detail::Lock lock {};
+    for (auto &r : M_state->regions)
+      {
+        ranges.emplace_back (r.data (), r.capacity ());
+        r.idle.cold = true;
+      }
+  }
+  // Issued without the lock held, see ‘detail::scavenge’.
+  for (const auto &range : ranges)
+    detail::advise_cold (range.first, range.second, pageout);
+}
+
+TemperatureScope::TemperatureScope (Temperature temperature)
+  : M_previous (detail::S_temperature)
+{
+  detail::S_temperature = temperature;
+}
+
+TemperatureScope::~TemperatureScope ()
+{
+  detail::S_temperature = M_previous;
+}
+
+Scope::Scope (Arena &arena)
+  : M_previous (detail::S_current_arena)
+{
+  detail::S_current_arena = arena.M_state;
+}
+
+Scope::~Scope ()
+{
+  detail::S_current_arena = M_previous;
+}
+
+namespace epoch
+{
+
+Guard::Guard ()
+{
+  auto &reader = detail::S_reader;
+  if (reader.depth++ != 0)
+    return;
+  if (reader.slot == nullptr)
+    reader.slot = detail::acquire_reader_slot ();
+  reader.slot->epoch.store (detail::S_epoch.load ());
+  std::atomic_thread_fence (std::memory_order_seq_cst);
+}
+
+Guard::~Guard ()
+{
+  auto &reader = detail::S_reader;
+  if (--reader.depth == 0)
+    reader.slot->epoch.store (0, std::memory_order_release);
+}
+
+std::size_t
+collect ()
+{
+  std::vector<detail::RetiredAllocation> reclaimable;
+  {
+    const detail::Lock lock {};
+    reclaimable = detail::take_reclaimable (nullptr);
+  }
+  return detail::reclaim (reclaimable);
+}
+
+void
+synchronize ()
+{
+  for (;;)
+    {
+      collect ();
+      {
+        const detail::Lock lock {};
+        if (detail::S_retired_count == 0
+            && detail::S_reclaiming == detail::S_own_reclaiming)
+          return;
+      }
+      std::this_thread::yield ();
+    }
+}
+
+} // namespace epoch
+
+namespace scavenger
+{
+
+static ARENA_CONSTINIT std::mutex S_control_mutex {};
+
+static detail::Scavenger &
+scavenger_state ()
+{
+  if (detail::S_scavenger == nullptr)
+    detail::S_scavenger = new detail::Scavenger ();
+  return *detail::S_scavenger;
+}
+
+void
+start (unsigned decay_ms)
+{
+  const std::lock_guard<std::mutex> control (S_control_mutex);
+  auto &scavenger = scavenger_state ();
+  {
+    const std::lock_guard<std::mutex> lock (scavenger.mutex);
+    scavenger.decay = std::chrono::milliseconds (decay_ms);
+  }
+  if (!scavenger.thread.joinable ())
+    scavenger.thread = std::thread (detail::scavenger_main, &scavenger);
+}
+
+void
+set_cold_after (unsigned idle_ms, bool pageout)
+{
+  const std::lock_guard<std::mutex> control (S_control_mutex);
+  auto &scavenger = scavenger_state ();
+  const std::lock_guard<std::mutex> lock (scavenger.mutex);
+  scavenger.cold_after = std::chrono::milliseconds (idle_ms);
+  scavenger.cold_pageout = pageout;
+}
+
+void
+stop ()
+{
+  const std::lock_guard<std::mutex> control (S_control_mutex);
+  detail::stop_scavenger ();
+}
+
+} // namespace scavenger
+
+namespace profiler
+{
+
+void
+start (std::size_t sample_interval)
+{
+  const detail::Lock lock {};
+  if (detail::S_profiler == nullptr)
+    detail::S_profiler = new detail::Profiler ();
+  detail::S_profiler->interval = std::max (sample_interval, std::size_t (1));
+  detail::S_profiler->until_sample = detail::S_profiler->next_sample_distance ();
+  detail::S_profiler->running = true;
+}
+
+void
+stop ()
+{
+  const detail::Lock lock {};
+  if (detail::S_profiler)
+    detail::S_profiler->running = false;
+}
+
+void
+reset ()
+{
+  const detail::Lock lock {};
+  if (detail::S_profiler == nullptr)
+    return;
+  detail::S_profiler->samples.clear ();
+  detail::S_profiler->buckets.clear ();
+}
+
+bool
+dump (const char *path)
+{
+  std::vector<std::pair<detail::stack_trace, detail::ProfileBucket>> buckets;
+  std::size_t interval = 0;
+  {
+    const detail::Lock lock {};
+    if (detail::S_profiler)
+      {
+        interval = detail::S_profiler->interval;
+        buckets.assign (detail::S_profiler->buckets.begin (),
+                        detail::S_profiler->buckets.end ());
+      }
+  }
+
+  std::FILE *f = std::fopen (path, "w");
+  if (f == nullptr)
+    return false;
+
+  detail::ProfileBucket total {};
+  for (const auto &[stack, bucket] : buckets)
+    {
+      total.live_count += bucket.live_count;
+      total.live_bytes += bucket.live_bytes;
+      total.total_count += bucket.total_count;
+      total.total_bytes += bucket.total_bytes;
+    }
+  std::fprintf (f, "heap profile: %6zu: %8zu [%6zu: %8zu] @ heap_v2/%zu\n",
+                total.live_count, total.live_bytes,
+                total.total_count, total.total_bytes, interval);
+  for (const auto &[stack, bucket] : buckets)
+    {
+      std::fprintf (f, "%6zu: %8zu [%6zu: %8zu] @",
+                    bucket.live_count, bucket.live_bytes,
+                    bucket.total_count, bucket.total_bytes);
+      for (void *frame : stack)
+        std::fprintf (f, " 0x%zx",
+                      static_cast<std::size_t> (reinterpret_cast<std::uintptr_t> (frame)));
+      std::fputc ('\n', f);
+    }
+
+  // pprof needs the memory map to symbolize the addresses.
+  std::fputs ("\nMAPPED_LIBRARIES:\n", f);
+  if (std::FILE *maps = std::fopen ("/proc/self/maps", "r"))
+    {
+      char buf[4096];
+      std::size_t n;
+      while ((n = std::fread (buf, 1, sizeof (buf), maps)) > 0)
+        std::fwrite (buf, 1, n, f);
+      std::fclose (maps);
+    }
+
+  const bool ok = !std::ferror (f);
+  return (std::fclose (f) == 0) && ok;
+}
+
+} // namespace profiler
+
 } // namespace arena
@@ -1,12 +1,26 @@
 #ifndef ARENA_ALLOC_HH
 #define ARENA_ALLOC_HH
 #include <cstddef>
+#include <iterator>
+#include <new>
+#include <string_view>
 #include <type_traits>
+#include <utility>
 
 namespace arena
 {
 namespace detail
 {
+struct ArenaState;
+
+struct DestructorEntry
+{
+  void (*destroy) (DestructorEntry *);
+  DestructorEntry *prev;
+  // Order of registration across all arenas.
+  unsigned long long sequence;
+};
+
 struct Lock
 {
   Lock ();
@@ -16,7 +30,328 @@ char * allocate (std::size_t n, std::size_t alignment, const char *hint);
 void deallocate (char *p, std::size_t n);
 char * reallocate (char *p, std::size_t from_n, std::size_t to_n,
                    std::size_t alignment, const char *hint);
+bool resize (char *p, std::size_t from_n, std::size_t to_n);
+std::size_t max_size_in_place (const char *p, std::size_t n);
 std::size_t default_region_size ();
+void reserve_contiguous (std::size_t n);
+void register_destructor (DestructorEntry *entry);
+void * allocate_frame (std::size_t n);
+bool deallocate_frame (void *p, std::size_t n);
+void retire (char *p, std::size_t n, void (*destroy) (char *, std::size_t));
+}
+
+/**
+ * Supplies the memory regions are created in.
+ *
+ * Implementations must be thread-safe if they are used by more than one
+ * arena, and must outlive all arenas using them.
+ */
+class MemoryProvider
+{
+public:
+  virtual ~MemoryProvider () = default;
+
+  /**
+   * @brief obtains memory for a region
+   *
+   * @param n - size of the region in bytes
+   * @return Pointer to at least ‘n’ bytes of memory suitably aligned for any
+   *         object type, or a null pointer on failure
+   */
+  virtual void * allocate (std::size_t n) = 0;
+
+  /**
+   * @brief gives back the memory of a region
+   *
+   * @param p - pointer obtained from @ref allocate()
+   * @param n - size passed to @ref allocate()
+   */
+  virtual void deallocate (void *p, std::size_t n) = 0;
+};
+
+/**
+ * @brief the default memory provider, mapping memory from the operating system
+ */
+MemoryProvider & system_memory ();
+
+/**
+ * @brief sets the memory provider used for new regions of the default arena
+ */
+void set_memory_provider (MemoryProvider &provider);
+
+/**
+ * A memory provider handing out consecutive parts of a caller supplied
+ * buffer, for pre-reserved pools and deterministic tests.
+ *
+ * Only the most recently allocated part is given back to the buffer on
+ * deallocation.  The provider is not thread-safe.
+ */
+class BufferMemoryProvider final : public MemoryProvider
+{
+public:
+  BufferMemoryProvider (void *buffer, std::size_t size);
+
+  void * allocate (std::size_t n) override;
+  void deallocate (void *p, std::size_t n) override;
+
+  /**
+   * @brief returns the number of bytes of the buffer currently handed out
+   */
+  std::size_t used () const;
+
+private:
+  char *M_begin;
+  char *M_top;
+  char *M_end;
+};
+
+/// Selects the constructor of @ref Arena that creates a child arena.
+struct child_of_t
+{
+  explicit child_of_t () = default;
+};
+
+inline constexpr child_of_t child_of {};
+
+/**
+ * A set of regions with its own lifetime.
+ *
+ * While an arena is made current with a @ref Scope, all allocations of the
+ * thread through @ref Allocator are placed in it.  Outside of any scope the
+ * process-wide default arena is used.
+ *
+ * All memory allocated from an arena is released when the arena is reset or
+ * destroyed; containers using that memory must not be used afterwards.
+ */
+class Arena
+{
+public:
+  /**
+   * @param provider - where the memory of the arena's regions comes from
+   */
+  explicit Arena (MemoryProvider &provider = system_memory ());
+
+  /**
+   * @brief creates a child arena
+   *
+   * The child takes free regions from ‘parent’ (or its ancestors) before
+   * creating new ones, and gives all its regions to ‘parent’ when it is
+   * reset or destroyed, so nested lifetimes get independent bulk reclamation
+   * without system calls.  ‘parent’ must outlive the child.
+   *
+   * The tag keeps ‘Arena b (a)’ an error, as arenas cannot be copied.
+   *
+   * @param parent - the arena to borrow regions from
+   */
+  Arena (child_of_t, Arena &parent);
+  ~Arena ();
+  Arena (const Arena &) = delete;
+  Arena & operator= (const Arena &) = delete;
+
+  /**
+   * @brief releases all memory allocated from the arena
+   *
+   * Memory retired with @ref epoch::retire() is reclaimed first, waiting for
+   * readers that may still see it, so this must not be called from within a
+   * reader critical section.  Then objects created in the arena with
+   * @ref make() are destroyed.  The regions are kept and reused for new
+   * allocations, or given to the parent of a child arena.
+   */
+  void reset ();
+
+  /**
+   * @brief takes over all regions of another arena
+   *
+   * All memory allocated from ‘other’, and the objects created in it with
+   * @ref make(), now belong to this arena and are released when it is reset
+   * or destroyed.  ‘other’ is left empty.  This takes time proportional to
+   * the number of regions and of objects created with @ref make(), not
+   * allocations, so a batch of data built on one thread can be handed to
+   * another without copying.  Objects of both arenas are still destroyed in
+   * the reverse order of their creation.
+   *
+   * @param other - the arena to take the regions of
+   */
+  void splice (Arena &other);
+
+  /**
+   * @brief hints that the arena's memory is rarely used
+   *
+   * The operating system reclaims the memory of the arena before other memory
+   * under memory pressure (‘MADV_COLD’), or right away if ‘pageout’ is true
+   * (‘MADV_PAGEOUT’).  The contents are preserved.  This has no effect on
+   * systems not supporting it.
+   */
+  void advise_cold (bool pageout = false);
+
+private:
+  friend class Scope;
+  detail::ArenaState *M_state;
+};
+
+/**
+ * Makes an arena the current arena of the calling thread for the lifetime of
+ * the scope.
+ *
+ * Scopes may be nested, destroying a scope restores the previously current
+ * arena.  Memory may be deallocated while any arena is current, it is
+ * returned to the arena it was allocated from.
+ */
+class Scope
+{
+public:
+  explicit Scope (Arena &arena);
+  ~Scope ();
+  Scope (const Scope &) = delete;
+  Scope & operator= (const Scope &) = delete;
+
+private:
+  detail::ArenaState *M_previous;
+};
+
+/**
+ * How frequently allocated memory is accessed.
+ */
+enum class Temperature : unsigned char
+{
+  normal,
+  /// Frequently accessed, packed densely with other hot memory.
+  hot,
+  /// Rarely accessed, kept away from other memory.
+  cold,
+};
+
+/**
+ * Sets the temperature of the calling thread's allocations for the lifetime
+ * of the scope.
+ *
+ * Allocations of different temperatures are placed in different regions, so
+ * hot data stays densely packed in cache and TLB while bulky cold data does
+ * not dilute it.  Scopes may be nested, destroying a scope restores the
+ * previous temperature.
+ */
+class TemperatureScope
+{
+public:
+  explicit TemperatureScope (Temperature temperature);
+  ~TemperatureScope ();
+  TemperatureScope (const TemperatureScope &) = delete;
+  TemperatureScope & operator= (const TemperatureScope &) = delete;
+
+private:
+  Temperature M_previous;
+};
+
+/**
+ * Allocation counters of one type, see @ref type_statistics().
+ */
+struct TypeStatistics
+{
+  /// Name of the allocator's value type.
+  std::string_view name;
+  std::size_t allocated_count;
+  std::size_t allocated_bytes;
+  std::size_t freed_count;
+  std::size_t freed_bytes;
+
+  std::size_t live_count () const { return allocated_count - freed_count; }
+  std::size_t live_bytes () const { return allocated_bytes - freed_bytes; }
+};
+
+/**
+ * @brief copies the per-type allocation counters
+ *
+ * Counters are only kept if ‘ARENA_TYPE_STATISTICS’ is defined in every
+ * translation unit including this header.  There is one entry for each type
+ * ‘T’ that ‘Allocator<T>’ has allocated memory for.
+ *
+ * @param out - array receiving the counters
+ * @param max - size of the array
+ * @return The number of types with counters, which may exceed ‘max’
+ */
+std::size_t type_statistics (TypeStatistics *out, std::size_t max);
+
+namespace detail
+{
+template <class T>
+constexpr std::string_view
+type_name ()
+{
+#if defined (__clang__) || defined (__GNUC__)
+  // "... type_name() [with T = int; ...]" (GCC) or "... [T = int]" (Clang)
+  const std::string_view name = __PRETTY_FUNCTION__;
+  const auto first = name.find ("T = ") + 4;
+  auto last = name.find ("; ", first);
+  if (last == name.npos)
+    last = name.rfind (']');
+  return name.substr (first, last - first);
+#elif defined (_MSC_VER)
+  const std::string_view name = __FUNCSIG__;
+  const auto first = name.find ("type_name<") + 10;
+  return name.substr (first, name.rfind (">(void)") - first);
+#else
+  return "unknown";
+#endif
+}
+
+struct TypeRecord
+{
+  explicit TypeRecord (std::string_view name);
+
+  TypeStatistics statistics;
+  TypeRecord *next;
+};
+
+/**
+ * Updates the counters of ‘T’.  Must be constructed before taking the lock,
+ * since the first use of a type registers it, and updated with the lock held.
+ */
+template <class T>
+struct TypeAccounting
+{
+#ifdef ARENA_TYPE_STATISTICS
+  TypeAccounting ()
+    : M_statistics (record ().statistics)
+  { }
+
+  void
+  allocated (std::size_t bytes)
+  {
+    ++M_statistics.allocated_count;
+    M_statistics.allocated_bytes += bytes;
+  }
+
+  void
+  freed (std::size_t bytes)
+  {
+    ++M_statistics.freed_count;
+    M_statistics.freed_bytes += bytes;
+  }
+
+  void
+  resized (std::size_t from_bytes, std::size_t to_bytes)
+  {
+    if (to_bytes > from_bytes)
+      M_statistics.allocated_bytes += to_bytes - from_bytes;
+    else
+      M_statistics.freed_bytes += from_bytes - to_bytes;
+  }
+
+private:
+  static TypeRecord &
+  record ()
+  {
+    static TypeRecord record (type_name<T> ());
+    return record;
+  }
+
+  TypeStatistics &M_statistics;
+#else
+  void allocated (std::size_t) { }
+  void freed (std::size_t) { }
+  void resized (std::size_t, std::size_t) { }
+#endif
+};
 }
 
 /**
@@ -24,7 +359,8 @@ std::size_t default_region_size ();
  *
  * The allocator is stateless, that is, all instances of the given allocator
  * are interchangeable, compare equal and can deallocate memory allocated by
- * any other instance of the same allocator type.
+ * any other instance of the same allocator type.  Memory is allocated from
+ * the arena current for the calling thread, see @ref Scope.
  *
  * The allocator satisfies allocator completeness requirements.
  */
@@ -60,7 +396,9 @@ struct Allocator
   {
     if (n == 0)
       return nullptr;
+    detail::TypeAccounting<T> accounting {};
     const detail::Lock lock {};
+    accounting.allocated (n * sizeof (T));
     return (reinterpret_cast<T *>
             (detail::allocate (n * sizeof (T), alignof (T),
                                reinterpret_cast<const char *> (hint))));
@@ -79,7 +417,9 @@ struct Allocator
   {
     if (p == nullptr)
       return;
+    detail::TypeAccounting<T> accounting {};
     const detail::Lock lock {};
+    accounting.freed (n * sizeof (T));
     detail::deallocate (reinterpret_cast<char *> (p), n * sizeof (T));
   }
 
@@ -120,12 +460,99 @@ struct Allocator
   [[nodiscard]] T *
   reallocate (T *p, std::size_t from_n, std::size_t to_n, const T *hint = nullptr)
   {
+    detail::TypeAccounting<T> accounting {};
     const detail::Lock lock {};
-    return (reinterpret_cast<T *>
-            (detail::reallocate (reinterpret_cast<char *> (p),
-                                 from_n * sizeof (T), to_n * sizeof (T),
-                                 alignof (T),
-                                 reinterpret_cast<const char *> (hint))));
+    T *const r = (reinterpret_cast<T *>
+                  (detail::reallocate (reinterpret_cast<char *> (p),
+                                       from_n * sizeof (T), to_n * sizeof (T),
+                                       alignof (T),
+                                       reinterpret_cast<const char *> (hint))));
+    if (p == nullptr)
+      accounting.allocated (to_n * sizeof (T));
+    else if (to_n == 0)
+      accounting.freed (from_n * sizeof (T));
+    else if (r == p)
+      accounting.resized (from_n * sizeof (T), to_n * sizeof (T));
+    else
+      {
+        accounting.allocated (to_n * sizeof (T));
+        accounting.freed (from_n * sizeof (T));
+      }
+    return r;
+  }
+
+  /**
+   * @brief expands previously allocated storage without moving it
+   *
+   * @param p - pointer obtained from the allocator
+   * @param old_n - number of objects allocated
+   * @param new_n - number of objects to expand the storage to, not less than
+   *                ‘old_n’
+   * @return ‘true’ if the storage now holds ‘new_n’ objects, always if
+   *         ‘new_n’ equals ‘old_n’, ‘false’ if it could not be expanded in
+   *         place, in which case it is unchanged.
+   *         The contents of the new part of the array are undefined.
+   */
+  bool
+  try_expand (T *p, std::size_t old_n, std::size_t new_n)
+  {
+    if (new_n < old_n)
+      return false;
+    // The storage already holds ‘new_n’ objects wherever it is.
+    if (new_n == old_n)
+      return true;
+    detail::TypeAccounting<T> accounting {};
+    const detail::Lock lock {};
+    if (!detail::resize (reinterpret_cast<char *> (p), old_n * sizeof (T),
+                         new_n * sizeof (T)))
+      return false;
+    accounting.resized (old_n * sizeof (T), new_n * sizeof (T));
+    return true;
+  }
+
+  /**
+   * @brief shrinks previously allocated storage without moving it
+   *
+   * @param p - pointer obtained from the allocator
+   * @param old_n - number of objects allocated
+   * @param new_n - number of objects to shrink the storage to, not more than
+   *                ‘old_n’ and not zero
+   * @return ‘true’ if the storage must now be deallocated with ‘new_n’,
+   *         having given back the space past ‘new_n’ objects, always if
+   *         ‘new_n’ equals ‘old_n’, ‘false’ if it is unchanged
+   */
+  bool
+  try_shrink (T *p, std::size_t old_n, std::size_t new_n)
+  {
+    if (new_n > old_n)
+      return false;
+    // The storage already holds ‘new_n’ objects wherever it is.
+    if (new_n == old_n)
+      return true;
+    detail::TypeAccounting<T> accounting {};
+    const detail::Lock lock {};
+    if (!detail::resize (reinterpret_cast<char *> (p), old_n * sizeof (T),
+                         new_n * sizeof (T)))
+      return false;
+    accounting.resized (old_n * sizeof (T), new_n * sizeof (T));
+    return true;
+  }
+
+  /**
+   * @brief returns how far storage could currently be expanded in place
+   *
+   * @param p - pointer obtained from the allocator
+   * @param n - number of objects allocated
+   * @return The largest number of objects @ref try_expand() would currently
+   *         succeed for, at least ‘n’
+   */
+  std::size_t
+  max_expand (const T *p, std::size_t n)
+  {
+    const detail::Lock lock {};
+    return (detail::max_size_in_place (reinterpret_cast<const char *> (p),
+                                       n * sizeof (T))
+            / sizeof (T));
   }
 
 };
@@ -140,96 +567,835 @@ inline bool
 operator!= (const Allocator<T> &, const Allocator<T> &)
 { return false; }
 
-}
+/**
+ * A string builder growing a single arena buffer, for hot paths where
+ * ‘basic_stringstream’ is too heavy.
+ *
+ * The buffer is grown through @ref Allocator::reallocate(), so it is usually
+ * expanded in place while nothing else is allocated from its region.  The
+ * contents are always null-terminated.
+ */
+class string_builder
+{
+public:
+  string_builder () = default;
+  explicit string_builder (std::size_t capacity) { reserve (capacity); }
+  string_builder (string_builder &&other) noexcept;
+  string_builder & operator= (string_builder &&other) noexcept;
+  ~string_builder ();
 
-#endif // !ARENA_ALLOC_HH
+  /**
+   * @brief makes room for at least ‘n’ characters
+   */
+  void reserve (std::size_t n);
 
-namespace arena
-{
+  string_builder & append (const char *s, std::size_t n);
+  string_builder & append (std::string_view s) { return append (s.data (), s.size ()); }
+  string_builder & append (const char *s) { return append (std::string_view (s)); }
+  string_builder & append (char c);
+  string_builder & append (double value);
 
-#if ((defined (_GLIBCXX_STRING) \
-      || defined (_LIBCPP_STRING) \
-      || defined (_STRING_)) \
-     && !defined (ARENA_HAS_STRING_DEF))
-#define ARENA_HAS_STRING_DEF
-template <class CharT, class TraitsT = std::char_traits<CharT>>
-using basic_string = std::basic_string<CharT, TraitsT, Allocator<CharT>>;
-using string = basic_string<char>;
-using wstring = basic_string<wchar_t>;
-#if __cplusplus >= 202002L
-using u8string = basic_string<char8_t>;
-#endif
-using u16string = basic_string<char16_t>;
-using u32string = basic_string<char32_t>;
-#endif
+  template <class Int,
+            std::enable_if_t<(std::is_integral_v<Int>
+                              && !std::is_same_v<Int, char>
+                              && !std::is_same_v<Int, bool>), int> = 0>
+  string_builder &
+  append (Int value)
+  {
+    if constexpr (std::is_signed_v<Int>)
+      return append_signed (value);
+    else
+      return append_unsigned (value);
+  }
 
-#if ((defined (_GLIBCXX_SSTREAM) \
-      || defined (_LIBCPP_SSTREAM) \
-      || defined (_SSTREAM_)) \
-     && !defined (ARENA_HAS_SSTREAM_DEF))
-#define ARENA_HAS_SSTREAM_DEF
-template <class CharT, class TraitsT = std::char_traits<CharT>>
-using basic_stringstream = std::basic_stringstream<CharT, TraitsT, Allocator<CharT>>;
-using stringstream = basic_stringstream<char>;
-using wstringstream = basic_stringstream<wchar_t>;
-// non-standard:
-#if __cplusplus >= 202002L
-using u8stringstream = basic_stringstream<char8_t>;
-#endif
-using u16stringstream = basic_stringstream<char16_t>;
-using u32stringstream = basic_stringstream<char32_t>;
-#endif
+  template <class Arg>
+  string_builder & operator<< (Arg &&arg) { return append (std::forward<Arg> (arg)); }
 
-#if ((defined (_GLIBCXX_DEQUE) \
-      || defined (_LIBCPP_DEQUE) \
-      || defined (_DEQUE_)) \
-     && !defined (ARENA_HAS_DEQUE_DEF))
-#define ARENA_HAS_DEQUE_DEF
-template <class T>
-using deque = std::deque<T, Allocator<T>>;
-#endif
+  const char * data () const { return M_data ? M_data : ""; }
+  const char * c_str () const { return data (); }
+  std::size_t size () const { return M_size; }
+  std::size_t capacity () const { return M_capacity; }
+  bool empty () const { return M_size == 0; }
+  std::string_view view () const { return { data (), M_size }; }
+  void clear ();
 
-#if ((defined (_GLIBCXX_VECTOR) \
-      || defined (_LIBCPP_VECTOR) \
-      || defined (_VECTOR_)) \
-     && !defined (ARENA_HAS_VECTOR_DEF))
-#define ARENA_HAS_VECTOR_DEF
-template <class T>
-using vector = std::vector<T, Allocator<T>>;
-#endif
+private:
+  string_builder & append_signed (long long value);
+  string_builder & append_unsigned (unsigned long long value);
+  char * grow (std::size_t n);
 
-#if ((defined (_GLIBCXX_FORWARD_LIST) \
-      || defined (_LIBCPP_FORWARD_LIST) \
-      || defined (_FORWARD_LIST_)) \
-     && !defined (ARENA_HAS_FORWARD_LIST_DEF))
-#define ARENA_HAS_FORWARD_LIST_DEF
-template <class T>
-using forward_list = std::forward_list<T, Allocator<T>>;
-#endif
+  char *M_data = nullptr;
+  std::size_t M_size = 0;
+  std::size_t M_capacity = 0;
+};
 
-#if ((defined (_GLIBCXX_LIST) \
-      || defined (_LIBCPP_LIST) \
-      || defined (_LIST_)) \
-     && !defined (ARENA_HAS_LIST_DEF))
-#define ARENA_HAS_LIST_DEF
+namespace detail
+{
+/// Deallocates the storage of one ‘T’ unless released, so a throwing
+/// constructor does not leave its region referenced for good.
 template <class T>
-using list = std::list<T, Allocator<T>>;
-#endif
+struct AllocationGuard
+{
+  T *p;
 
-#if ((defined (_GLIBCXX_SET) \
-      || defined (_LIBCPP_SET) \
-      || defined (_SET_)) \
-     && !defined (ARENA_HAS_SET_DEF))
-#define ARENA_HAS_SET_DEF
-template <class T, class Compare = std::less<T>>
-using set = std::set<T, Compare, Allocator<T>>;
+  ~AllocationGuard ()
+  {
+    if (p)
+      Allocator<T> ().deallocate (p, 1);
+  }
 
-template <class T, class Compare=std::less<T>>
-using multiset = std::multiset<T, Compare, Allocator<T>>;
-#endif
+  T *
+  release ()
+  {
+    return std::exchange (p, nullptr);
+  }
+};
+}
 
-#if ((defined (_GLIBCXX_MAP) \
-      || defined (_LIBCPP_MAP) \
+/**
+ * @brief creates an object owned by the current arena
+ *
+ * The object is destroyed when the arena is reset or destroyed, objects are
+ * destroyed in the reverse order of their creation.  A destructor is only
+ * recorded for types that are not trivially destructible.  The object must
+ * not be destroyed or deallocated individually.
+ *
+ * @param args - arguments to construct the object with
+ * @return Pointer to the new object
+ */
+template <class T, class... Args>
+T *
+make (Args &&...args)
+{
+  if constexpr (std::is_trivially_destructible_v<T>)
+    {
+      detail::AllocationGuard<T> storage {Allocator<T> ().allocate (1)};
+      ::new (static_cast<void *> (storage.p)) T (std::forward<Args> (args)...);
+      return storage.release ();
+    }
+  else
+    {
+      // The destructor entry is placed directly in front of the object.
+      struct Block
+      {
+        detail::DestructorEntry entry;
+        alignas (T) unsigned char storage[sizeof (T)];
+      };
+      detail::AllocationGuard<Block> storage {Allocator<Block> ().allocate (1)};
+      Block *block = storage.p;
+      T *object = ::new (static_cast<void *> (block->storage))
+        T (std::forward<Args> (args)...);
+      storage.release ();
+      block->entry.destroy = [] (detail::DestructorEntry *entry) {
+        auto block = reinterpret_cast<Block *> (entry);
+        std::launder (reinterpret_cast<T *> (block->storage))->~T ();
+      };
+      const detail::Lock lock {};
+      detail::register_destructor (&block->entry);
+      return object;
+    }
+}
+
+/**
+ * @brief discards a container without deallocating its elements
+ *
+ * Empties ‘container’ in constant time without destroying or deallocating
+ * its elements; their memory stays allocated until the arena it came from
+ * is reset or destroyed.  Destructors of the elements are skipped, so any
+ * resources they own besides arena memory leak.
+ *
+ * The default arena is never reset, so discarding a container allocated
+ * outside of any @ref Scope leaks its memory for the rest of the process.
+ * Only discard containers of arenas that are reset or destroyed afterwards.
+ *
+ * @param container - a container using @ref Allocator
+ */
+template <class Container>
+void
+discard_unchecked (Container &container)
+{
+  using allocator_type = typename Container::allocator_type;
+  static_assert (std::is_same_v<allocator_type,
+                                Allocator<typename allocator_type::value_type>>,
+                 "discarded containers must use arena::Allocator");
+  // Moving takes over all elements, and the union never destroys them.
+  union Discarded
+  {
+    Discarded () {}
+    ~Discarded () {}
+    Container container;
+  } discarded;
+  ::new (static_cast<void *> (&discarded.container))
+    Container (std::move (container));
+  container.clear ();
+}
+
+/**
+ * @brief discards a container of trivially destructible elements
+ *
+ * Like @ref discard_unchecked(), for elements which need no destruction, so
+ * a large map or list is torn down without walking its nodes.
+ *
+ * @param container - a container using @ref Allocator
+ */
+template <class Container>
+void
+discard (Container &container)
+{
+  static_assert (std::is_trivially_destructible_v<
+                   typename Container::value_type>,
+                 "use discard_unchecked for elements with destructors");
+  discard_unchecked (container);
+}
+
+namespace detail
+{
+constexpr unsigned
+floor_log2 (std::size_t n)
+{
+#if defined (__clang__) || defined (__GNUC__)
+  return sizeof (unsigned long long) * 8 - 1 - __builtin_clzll (n);
+#else
+  unsigned result = 0;
+  while (n >>= 1)
+    ++result;
+  return result;
+#endif
+}
+}
+
+/**
+ * A vector of arena chunks whose elements never move.
+ *
+ * Chunk ‘k’ holds twice as many elements as chunk ‘k - 1’, so the chunks
+ * grow along with the regions they are allocated from, and appending never
+ * copies elements or invalidates pointers to them.  Indexing takes constant
+ * time.
+ */
+template <class T>
+class stable_vector
+{
+  static constexpr std::size_t
+  first_chunk_size ()
+  {
+    // The first chunk fills at least a page.
+    std::size_t n = 1;
+    while (n * sizeof (T) < 4096)
+      n *= 2;
+    return n;
+  }
+
+  static constexpr std::size_t S_first_chunk = first_chunk_size ();
+  static constexpr unsigned S_first_chunk_log2
+    = detail::floor_log2 (S_first_chunk);
+  static constexpr unsigned S_chunks = 64 - S_first_chunk_log2;
+
+  template <class V>
+  class basic_iterator
+  {
+    using container_type = std::conditional_t<std::is_const_v<V>,
+                                              const stable_vector,
+                                              stable_vector>;
+
+  public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = std::remove_const_t<V>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = V *;
+    using reference = V &;
+
+    basic_iterator () = default;
+    basic_iterator (container_type *container, std::size_t index)
+      : M_container (container), M_index (index)
+    {}
+    // Converts an iterator to a const_iterator.
+    template <class U, class = std::enable_if_t<std::is_same_v<const U, V>
+                                                && !std::is_same_v<U, V>>>
+    basic_iterator (const basic_iterator<U> &other)
+      : M_container (other.M_container), M_index (other.M_index)
+    {}
+
+    reference operator* () const { return (*M_container)[M_index]; }
+    pointer operator-> () const { return &**this; }
+    reference operator[] (difference_type n) const { return *(*this + n); }
+
+    basic_iterator & operator++ () { ++M_index; return *this; }
+    basic_iterator & operator-- () { --M_index; return *this; }
+    basic_iterator operator++ (int) { auto r = *this; ++M_index; return r; }
+    basic_iterator operator-- (int) { auto r = *this; --M_index; return r; }
+    basic_iterator &
+    operator+= (difference_type n)
+    { M_index += n; return *this; }
+    basic_iterator &
+    operator-= (difference_type n)
+    { M_index -= n; return *this; }
+
+    friend basic_iterator
+    operator+ (basic_iterator it, difference_type n)
+    { return it += n; }
+    friend basic_iterator
+    operator+ (difference_type n, basic_iterator it)
+    { return it += n; }
+    friend basic_iterator
+    operator- (basic_iterator it, difference_type n)
+    { return it -= n; }
+    friend difference_type
+    operator- (const basic_iterator &a, const basic_iterator &b)
+    { return a.M_index - b.M_index; }
+
+    friend bool
+    operator== (const basic_iterator &a, const basic_iterator &b)
+    { return a.M_index == b.M_index; }
+    friend bool
+    operator!= (const basic_iterator &a, const basic_iterator &b)
+    { return a.M_index != b.M_index; }
+    friend bool
+    operator< (const basic_iterator &a, const basic_iterator &b)
+    { return a.M_index < b.M_index; }
+    friend bool
+    operator> (const basic_iterator &a, const basic_iterator &b)
+    { return a.M_index > b.M_index; }
+    friend bool
+    operator<= (const basic_iterator &a, const basic_iterator &b)
+    { return a.M_index <= b.M_index; }
+    friend bool
+    operator>= (const basic_iterator &a, const basic_iterator &b)
+    { return a.M_index >= b.M_index; }
+
+  private:
+    template <class>
+    friend class basic_iterator;
+
+    container_type *M_container = nullptr;
+    std::size_t M_index = 0;
+  };
+
+public:
+  using value_type = T;
+  using allocator_type = Allocator<T>;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using reference = T &;
+  using const_reference = const T &;
+  using pointer = T *;
+  using const_pointer = const T *;
+  using iterator = basic_iterator<T>;
+  using const_iterator = basic_iterator<const T>;
+
+  stable_vector () = default;
+
+  stable_vector (const stable_vector &other)
+    : stable_vector ()
+  {
+    *this = other;
+  }
+
+  stable_vector (stable_vector &&other) noexcept
+  {
+    swap (other);
+  }
+
+  ~stable_vector ()
+  {
+    clear ();
+    for (unsigned k = 0; k < M_chunk_count; ++k)
+      Allocator<T> ().deallocate (M_chunks[k], chunk_size (k));
+  }
+
+  stable_vector &
+  operator= (const stable_vector &other)
+  {
+    if (this != &other)
+      {
+        clear ();
+        reserve (other.size ());
+        for (const T &value : other)
+          push_back (value);
+      }
+    return *this;
+  }
+
+  stable_vector &
+  operator= (stable_vector &&other) noexcept
+  {
+    stable_vector (std::move (other)).swap (*this);
+    return *this;
+  }
+
+  void
+  swap (stable_vector &other) noexcept
+  {
+    std::swap (M_chunks, other.M_chunks);
+    std::swap (M_chunk_count, other.M_chunk_count);
+    std::swap (M_size, other.M_size);
+  }
+
+  reference
+  operator[] (size_type i)
+  {
+    const std::size_t j = i + S_first_chunk;
+    const unsigned k = detail::floor_log2 (j) - S_first_chunk_log2;
+    return M_chunks[k][j - (S_first_chunk << k)];
+  }
+
+  const_reference
+  operator[] (size_type i) const
+  {
+    return const_cast<stable_vector &> (*this)[i];
+  }
+
+  reference front () { return (*this)[0]; }
+  const_reference front () const { return (*this)[0]; }
+  reference back () { return (*this)[M_size - 1]; }
+  const_reference back () const { return (*this)[M_size - 1]; }
+
+  iterator begin () { return iterator (this, 0); }
+  iterator end () { return iterator (this, M_size); }
+  const_iterator begin () const { return const_iterator (this, 0); }
+  const_iterator end () const { return const_iterator (this, M_size); }
+  const_iterator cbegin () const { return begin (); }
+  const_iterator cend () const { return end (); }
+
+  bool empty () const { return M_size == 0; }
+  size_type size () const { return M_size; }
+
+  size_type
+  capacity () const
+  {
+    return (S_first_chunk << M_chunk_count) - S_first_chunk;
+  }
+
+  /**
+   * @brief allocates chunks for at least ‘n’ elements
+   *
+   * @param n - the number of elements to make room for
+   */
+  void
+  reserve (size_type n)
+  {
+    while (capacity () < n)
+      add_chunk ();
+  }
+
+  template <class... Args>
+  reference
+  emplace_back (Args &&...args)
+  {
+    if (M_size == capacity ())
+      add_chunk ();
+    T *p = &(*this)[M_size];
+    ::new (static_cast<void *> (p)) T (std::forward<Args> (args)...);
+    ++M_size;
+    return *p;
+  }
+
+  void push_back (const T &value) { emplace_back (value); }
+  void push_back (T &&value) { emplace_back (std::move (value)); }
+
+  void
+  pop_back ()
+  {
+    --M_size;
+    (*this)[M_size].~T ();
+  }
+
+  /// Destroys all elements, keeping the chunks for reuse.
+  void
+  clear ()
+  {
+    if constexpr (!std::is_trivially_destructible_v<T>)
+      {
+        while (M_size)
+          pop_back ();
+      }
+    M_size = 0;
+  }
+
+private:
+  static constexpr std::size_t
+  chunk_size (unsigned k)
+  {
+    return S_first_chunk << k;
+  }
+
+  void
+  add_chunk ()
+  {
+    const T *hint = M_chunk_count ? M_chunks[M_chunk_count - 1] : nullptr;
+    M_chunks[M_chunk_count]
+      = Allocator<T> ().allocate (chunk_size (M_chunk_count), hint);
+    ++M_chunk_count;
+  }
+
+  T *M_chunks[S_chunks] {};
+  unsigned M_chunk_count = 0;
+  size_type M_size = 0;
+};
+
+/**
+ * @brief sets the size limits for newly created regions
+ *
+ * The size of new regions adapts to the observed allocation sizes and the
+ * amount of memory already in use, within these limits.  Allocations larger
+ * than ‘max_size’ still get a region of their own.  ‘min_size’ is raised to
+ * at least 4096 bytes and ‘max_size’ to at least ‘min_size’.
+ *
+ * @param min_size - smallest size of a new region in bytes
+ * @param max_size - largest size of a new region in bytes
+ */
+void set_region_size_bounds (std::size_t min_size, std::size_t max_size);
+
+/**
+ * @brief reserves contiguous memory for upcoming allocations
+ *
+ * Creates one region large enough for ‘bytes’ bytes in the current arena,
+ * and places the next allocations of the calling thread there until they
+ * total ‘bytes’ bytes, so a build phase gets its memory contiguously instead
+ * of scattered across partially filled regions.  Other threads allocating
+ * from the same arena meanwhile use its other regions.  The reservation ends
+ * early when an allocation does not fit the rest of it, when the arena is
+ * reset, or when another reservation is made in the arena.
+ *
+ * @param bytes - total size of the upcoming allocations
+ */
+inline void
+reserve_contiguous (std::size_t bytes)
+{
+  const detail::Lock lock {};
+  detail::reserve_contiguous (bytes);
+}
+
+/**
+ * @brief pre-faults the pages of large new regions
+ *
+ * Regions of at least ‘min_size’ bytes have all their pages faulted in when
+ * they are created, split across ‘threads’ threads (using
+ * ‘MADV_POPULATE_WRITE’ where supported), so a large region is ready for use
+ * without page faults.  The helper threads are started here and kept for the
+ * rest of the process.  Other threads keep allocating while a region is
+ * pre-faulted, the region is only added to its arena once it is ready.
+ *
+ * @param min_size - smallest region size to pre-fault, 0 disables pre-faulting
+ * @param threads - number of threads to use, including the allocating thread
+ */
+void set_prefault (std::size_t min_size, unsigned threads = 4);
+
+/// Placement of new regions on NUMA nodes.
+enum class NumaPolicy : unsigned char
+{
+  /// Pages are placed on the node of the thread first touching them.
+  none,
+  /// Regions are placed on the node of the allocating thread, and threads
+  /// allocate from regions on their own node.
+  local,
+  /// Pages of new regions are interleaved across all nodes.
+  interleave,
+  /// Regions are placed on one given node.
+  node,
+};
+
+/**
+ * @brief sets the NUMA placement of new regions
+ *
+ * Regions are bound to their node with ‘mbind’ before they are first
+ * touched, preferring but not requiring that node.  On single-node systems,
+ * or where ‘mbind’ is not supported, the policy stays @ref NumaPolicy::none.
+ * So does @ref NumaPolicy::node with a node that does not exist.
+ *
+ * @param policy - the placement of new regions
+ * @param node - the node used with @ref NumaPolicy::node, less than
+ *   @ref numa_nodes()
+ */
+void set_numa_policy (NumaPolicy policy, unsigned node = 0);
+
+/**
+ * @brief returns the number of NUMA nodes
+ *
+ * @return the highest node number plus one, 1 where NUMA is not supported
+ */
+unsigned numa_nodes ();
+
+/**
+ * Usage statistics of all arenas.
+ */
+struct Statistics
+{
+  /// Number of regions.
+  std::size_t regions;
+  /// Total size of all regions.
+  std::size_t mapped_bytes;
+  /// Bytes up to the top of each region, including deallocated space that
+  /// has not been reclaimed yet.
+  std::size_t used_bytes;
+  /// Number of regions that have been pre-faulted.
+  std::size_t prefaulted_regions;
+  /// Total size of the pre-faulted regions.
+  std::size_t prefaulted_bytes;
+  /// Total time spent pre-faulting, in nanoseconds.
+  unsigned long long prefault_ns;
+  /// Time until the most recently pre-faulted region was ready, in
+  /// nanoseconds.
+  unsigned long long last_prefault_ns;
+};
+
+/**
+ * @brief returns a snapshot of the usage statistics
+ */
+Statistics statistics ();
+
+/**
+ * Epoch-based reclamation.
+ *
+ * Lock-free readers enter a critical section with a @ref Guard, writers hand
+ * memory that readers may still see to @ref retire() instead of deallocating
+ * it.  Retired memory is destroyed and deallocated in batches once every
+ * reader that could have observed it has left its critical section.
+ */
+namespace epoch
+{
+/**
+ * A reader critical section.
+ *
+ * Memory retired while a guard is alive is not reclaimed until the guard is
+ * destroyed.  Guards may be nested.
+ */
+struct Guard
+{
+  Guard ();
+  ~Guard ();
+  Guard (const Guard &) = delete;
+  Guard & operator= (const Guard &) = delete;
+};
+
+/**
+ * @brief defers destruction and deallocation until no reader can see ‘p’
+ *
+ * ‘p’ must have been obtained from an @ref Allocator and must already be
+ * unreachable for readers entering a critical section from now on.  When it
+ * is reclaimed, the ‘n’ objects are destroyed and the storage deallocated as
+ * if by ‘Allocator<T>::deallocate (p, n)’.
+ *
+ * @param p - pointer obtained from the allocator
+ * @param n - number of objects allocated
+ */
+template <class T>
+void
+retire (T *p, std::size_t n = 1)
+{
+  if (p == nullptr)
+    return;
+  void (*destroy) (char *, std::size_t) = nullptr;
+  if constexpr (!std::is_trivially_destructible_v<T>)
+    destroy = [] (char *p, std::size_t bytes) {
+      for (std::size_t i = 0; i < bytes / sizeof (T); ++i)
+        reinterpret_cast<T *> (p)[i].~T ();
+    };
+#ifdef ARENA_TYPE_STATISTICS
+  {
+    // Retired memory is no longer reachable, count it as freed right away.
+    detail::TypeAccounting<T> accounting {};
+    const detail::Lock lock {};
+    accounting.freed (n * sizeof (T));
+  }
+#endif
+  detail::retire (reinterpret_cast<char *> (p), n * sizeof (T), destroy);
+}
+
+/**
+ * @brief advances the epoch if possible and reclaims retired memory
+ *
+ * This is also done automatically once enough memory has been retired.
+ *
+ * @return The number of reclaimed allocations
+ */
+std::size_t collect ();
+
+/**
+ * @brief waits until all memory retired so far has been reclaimed
+ *
+ * Must not be called from within a reader critical section.
+ */
+void synchronize ();
+}
+
+/**
+ * Background scavenger returning the memory of empty regions to the
+ * operating system.
+ *
+ * Regions that have been empty for the decay time have their pages freed
+ * lazily (‘MADV_FREE’), regions that have been empty for twice the decay
+ * time are unmapped.  All of this happens on a background thread.
+ */
+namespace scavenger
+{
+/**
+ * @brief starts the scavenger thread
+ *
+ * If the scavenger is already running only the decay time is changed.
+ *
+ * @param decay_ms - time in milliseconds a region must have been empty before
+ *                   its pages are freed
+ */
+void start (unsigned decay_ms = 10000);
+
+/**
+ * @brief marks idle regions as cold
+ *
+ * While the scavenger is running, regions that have not been allocated from
+ * for ‘idle_ms’ milliseconds are hinted as cold, like with
+ * @ref Arena::advise_cold().
+ *
+ * @param idle_ms - idle time in milliseconds, 0 disables the policy
+ * @param pageout - whether to page the memory out right away
+ */
+void set_cold_after (unsigned idle_ms, bool pageout = false);
+
+/**
+ * @brief stops the scavenger thread
+ */
+void stop ();
+}
+
+/**
+ * Sampling heap profiler.
+ *
+ * While running, roughly every ‘sample_interval’ bytes allocated through the
+ * arena a stack trace is captured and the allocation is recorded until it is
+ * deallocated.
+ */
+namespace profiler
+{
+/**
+ * @brief starts sampling allocations
+ *
+ * The distance between samples is randomized with a mean of ‘sample_interval’
+ * bytes.  If the profiler is already running only the interval is changed.
+ *
+ * @param sample_interval - mean number of bytes between samples
+ */
+void start (std::size_t sample_interval = 512 * 1024);
+
+/**
+ * @brief stops sampling new allocations
+ *
+ * Allocations that were already sampled are still tracked until they are
+ * deallocated and remain part of the profile.
+ */
+void stop ();
+
+/**
+ * @brief discards all recorded samples
+ */
+void reset ();
+
+/**
+ * @brief writes the live sampled allocations as a heap profile
+ *
+ * The profile uses the legacy gperftools heap profile format, which can be
+ * read by ‘pprof’.
+ *
+ * @param path - file to write the profile to
+ * @return ‘true’ on success, ‘false’ if the file could not be written
+ */
+bool dump (const char *path);
+}
+
+}
+
+#endif // !ARENA_ALLOC_HH
+
+namespace arena
+{
+
+#if ((defined (_GLIBCXX_STRING) \
+      || defined (_LIBCPP_STRING) \
+      || defined (_STRING_)) \
+     && !defined (ARENA_HAS_STRING_DEF))
+#define ARENA_HAS_STRING_DEF
+template <class CharT, class TraitsT = std::char_traits<CharT>>
+using basic_string = std::basic_string<CharT, TraitsT, Allocator<CharT>>;
+using string = basic_string<char>;
+using wstring = basic_string<wchar_t>;
+#if __cplusplus >= 202002L
+using u8string = basic_string<char8_t>;
+#endif
+using u16string = basic_string<char16_t>;
+using u32string = basic_string<char32_t>;
+
+inline string
+to_string (const string_builder &builder)
+{
+  return string (builder.data (), builder.size ());
+}
+#endif
+
+#if ((defined (_GLIBCXX_SSTREAM) \
+      || defined (_LIBCPP_SSTREAM) \
+      || defined (_SSTREAM_)) \
+     && !defined (ARENA_HAS_SSTREAM_DEF))
+#define ARENA_HAS_SSTREAM_DEF
+template <class CharT, class TraitsT = std::char_traits<CharT>>
+using basic_stringstream = std::basic_stringstream<CharT, TraitsT, Allocator<CharT>>;
+using stringstream = basic_stringstream<char>;
+using wstringstream = basic_stringstream<wchar_t>;
+// non-standard:
+#if __cplusplus >= 202002L
+using u8stringstream = basic_stringstream<char8_t>;
+#endif
+using u16stringstream = basic_stringstream<char16_t>;
+using u32stringstream = basic_stringstream<char32_t>;
+#endif
+
+#if ((defined (_GLIBCXX_DEQUE) \
+      || defined (_LIBCPP_DEQUE) \
+      || defined (_DEQUE_)) \
+     && !defined (ARENA_HAS_DEQUE_DEF))
+#define ARENA_HAS_DEQUE_DEF
+template <class T>
+using deque = std::deque<T, Allocator<T>>;
+#endif
+
+#if ((defined (_GLIBCXX_VECTOR) \
+      || defined (_LIBCPP_VECTOR) \
+      || defined (_VECTOR_)) \
+     && !defined (ARENA_HAS_VECTOR_DEF))
+#define ARENA_HAS_VECTOR_DEF
+template <class T>
+using vector = std::vector<T, Allocator<T>>;
+#endif
+
+#if ((defined (_GLIBCXX_FORWARD_LIST) \
+      || defined (_LIBCPP_FORWARD_LIST) \
+      || defined (_FORWARD_LIST_)) \
+     && !defined (ARENA_HAS_FORWARD_LIST_DEF))
+#define ARENA_HAS_FORWARD_LIST_DEF
+template <class T>
+using forward_list = std::forward_list<T, Allocator<T>>;
+#endif
+
+#if ((defined (_GLIBCXX_LIST) \
+      || defined (_LIBCPP_LIST) \
+      || defined (_LIST_)) \
+     && !defined (ARENA_HAS_LIST_DEF))
+#define ARENA_HAS_LIST_DEF
+template <class T>
+using list = std::list<T, Allocator<T>>;
+#endif
+
+#if ((defined (_GLIBCXX_SET) \
+      || defined (_LIBCPP_SET) \
+      || defined (_SET_)) \
+     && !defined (ARENA_HAS_SET_DEF))
+#define ARENA_HAS_SET_DEF
+template <class T, class Compare = std::less<T>>
+using set = std::set<T, Compare, Allocator<T>>;
+
+template <class T, class Compare=std::less<T>>
+using multiset = std::multiset<T, Compare, Allocator<T>>;
+#endif
+
+#if ((defined (_GLIBCXX_MAP) \
+      || defined (_LIBCPP_MAP) \
       || defined (_MAP_)) \
      && !defined (ARENA_HAS_MAP_DEF))
 #define ARENA_HAS_MAP_DEF
@@ -264,5 +1430,322 @@ template <class Key, class Value, class Hash = std::hash<Key>, class KeyEqual =
 using unordered_multimap = std::unordered_multimap<Key, Value, Hash, KeyEqual, Allocator<std::pair<const Key, Value>>>;
 #endif
 
+#if ((defined (_GLIBCXX_MEMORY) \
+      || defined (_LIBCPP_MEMORY) \
+      || defined (_MEMORY_)) \
+     && !defined (ARENA_HAS_MEMORY_DEF))
+#define ARENA_HAS_MEMORY_DEF
+/**
+ * A stateless deleter destroying an object and returning its memory to the
+ * arena, so ‘unique_ptr’ stays the size of a pointer.
+ *
+ * It does not convert to the deleter of a base class, since the memory must
+ * be deallocated with the size of the type it was created as.
+ */
+template <class T>
+struct Deleter
+{
+  void
+  operator() (T *p) const
+  {
+    p->~T ();
+    Allocator<T> ().deallocate (p, 1);
+  }
+};
+
+template <class T>
+using unique_ptr = std::unique_ptr<T, Deleter<T>>;
+
+template <class T, class... Args>
+unique_ptr<T>
+make_unique (Args &&...args)
+{
+  detail::AllocationGuard<T> storage {Allocator<T> ().allocate (1)};
+  ::new (static_cast<void *> (storage.p)) T (std::forward<Args> (args)...);
+  return unique_ptr<T> (storage.release ());
+}
+
+template <class T, class... Args>
+std::shared_ptr<T>
+make_shared (Args &&...args)
+{
+  return std::allocate_shared<T> (Allocator<T> (), std::forward<Args> (args)...);
+}
+
+/**
+ * A shared pointer with a non-atomic reference count, for objects that are
+ * only shared within one thread.
+ *
+ * The count is allocated together with the object in the arena, see
+ * @ref make_local_shared().
+ */
+template <class T>
+class local_shared_ptr
+{
+public:
+  local_shared_ptr () = default;
+  local_shared_ptr (std::nullptr_t) { }
+
+  local_shared_ptr (const local_shared_ptr &other)
+    : M_block (other.M_block)
+  {
+    if (M_block)
+      ++M_block->count;
+  }
+
+  local_shared_ptr (local_shared_ptr &&other) noexcept
+    : M_block (std::exchange (other.M_block, nullptr))
+  { }
+
+  ~local_shared_ptr () { release (); }
+
+  local_shared_ptr &
+  operator= (local_shared_ptr other) noexcept
+  {
+    swap (other);
+    return *this;
+  }
+
+  void swap (local_shared_ptr &other) noexcept { std::swap (M_block, other.M_block); }
+  void reset () { local_shared_ptr ().swap (*this); }
+
+  T * get () const { return M_block ? &M_block->value : nullptr; }
+  T & operator* () const { return M_block->value; }
+  T * operator-> () const { return &M_block->value; }
+  std::size_t use_count () const { return M_block ? M_block->count : 0; }
+  explicit operator bool () const { return M_block != nullptr; }
+
+  friend bool
+  operator== (const local_shared_ptr &a, const local_shared_ptr &b)
+  { return a.M_block == b.M_block; }
+
+  friend bool
+  operator!= (const local_shared_ptr &a, const local_shared_ptr &b)
+  { return a.M_block != b.M_block; }
+
+private:
+  struct Block
+  {
+    template <class... Args>
+    Block (Args &&...args)
+      : value (std::forward<Args> (args)...)
+    { }
+
+    std::size_t count = 1;
+    T value;
+  };
+
+  template <class U, class... Args>
+  friend local_shared_ptr<U> make_local_shared (Args &&...args);
+
+  void
+  release ()
+  {
+    if (M_block == nullptr || --M_block->count != 0)
+      return;
+    M_block->~Block ();
+    Allocator<Block> ().deallocate (M_block, 1);
+  }
+
+  Block *M_block = nullptr;
+};
+
+template <class T, class... Args>
+local_shared_ptr<T>
+make_local_shared (Args &&...args)
+{
+  using Block = typename local_shared_ptr<T>::Block;
+  local_shared_ptr<T> result;
+  detail::AllocationGuard<Block> storage {Allocator<Block> ().allocate (1)};
+  ::new (static_cast<void *> (storage.p)) Block (std::forward<Args> (args)...);
+  result.M_block = storage.release ();
+  return result;
+}
+#endif
+
+#if ((defined (_GLIBCXX_ATOMIC) \
+      || defined (_LIBCPP_ATOMIC) \
+      || defined (_ATOMIC_)) \
+     && !defined (ARENA_HAS_ATOMIC_DEF))
+#define ARENA_HAS_ATOMIC_DEF
+/**
+ * An append-only vector many threads can append to and read from
+ * concurrently.
+ *
+ * Appending reserves a slot with an atomic increment and publishes the
+ * element once it is constructed; only the thread allocating a new segment
+ * takes the arena lock.  Segments double in size like those of
+ * @ref stable_vector, so elements never move.  Reading a published element
+ * is wait-free.  Destruction must not race with other operations.
+ */
+template <class T>
+class concurrent_vector
+{
+  struct Slot
+  {
+    alignas (T) unsigned char storage[sizeof (T)];
+    std::atomic<bool> published;
+  };
+
+  static constexpr std::size_t S_first_segment = 64;
+  static constexpr unsigned S_first_segment_log2
+    = detail::floor_log2 (S_first_segment);
+  static constexpr unsigned S_segments = 64 - S_first_segment_log2;
+
+public:
+  using value_type = T;
+  using allocator_type = Allocator<T>;
+  using size_type = std::size_t;
+
+  concurrent_vector () = default;
+  concurrent_vector (const concurrent_vector &) = delete;
+  concurrent_vector & operator= (const concurrent_vector &) = delete;
+
+  ~concurrent_vector ()
+  {
+    for (unsigned k = 0; k < S_segments; ++k)
+      {
+        Slot *segment = M_segments[k].load (std::memory_order_relaxed);
+        if (segment == nullptr)
+          continue;
+        for (std::size_t i = 0; i < segment_size (k); ++i)
+          {
+            if (segment[i].published.load (std::memory_order_relaxed))
+              std::launder (reinterpret_cast<T *> (segment[i].storage))->~T ();
+            segment[i].published.~atomic ();
+          }
+        Allocator<Slot> ().deallocate (segment, segment_size (k));
+      }
+  }
+
+  /**
+   * @brief appends an element
+   *
+   * A new segment is allocated from the current arena of the calling thread.
+   *
+   * @param args - arguments to construct the element with
+   * @return Index of the new element
+   */
+  template <class... Args>
+  size_type
+  emplace_back (Args &&...args)
+  {
+    const size_type i = M_size.fetch_add (1, std::memory_order_relaxed);
+    Slot &slot = reserve_slot (i);
+    ::new (static_cast<void *> (slot.storage)) T (std::forward<Args> (args)...);
+    slot.published.store (true, std::memory_order_release);
+    return i;
+  }
+
+  size_type push_back (const T &value) { return emplace_back (value); }
+  size_type push_back (T &&value) { return emplace_back (std::move (value)); }
+
+  /**
+   * @brief returns the element at ‘i’ if it is published
+   *
+   * @param i - index of the element
+   * @return Pointer to the element, or a null pointer if it is not
+   *         constructed yet
+   */
+  const T *
+  get (size_type i) const
+  {
+    const std::size_t j = i + S_first_segment;
+    const unsigned k = detail::floor_log2 (j) - S_first_segment_log2;
+    const Slot *segment = M_segments[k].load (std::memory_order_acquire);
+    if (segment == nullptr)
+      return nullptr;
+    const Slot &slot = segment[j - (S_first_segment << k)];
+    if (!slot.published.load (std::memory_order_acquire))
+      return nullptr;
+    return std::launder (reinterpret_cast<const T *> (slot.storage));
+  }
+
+  /// Returns the element at ‘i’, which must be published.
+  const T & operator[] (size_type i) const { return *get (i); }
+
+  /**
+   * @brief returns the number of reserved slots
+   *
+   * Elements below the size may still be under construction, see @ref get().
+   */
+  size_type size () const { return M_size.load (std::memory_order_acquire); }
+  bool empty () const { return size () == 0; }
+
+private:
+  static constexpr std::size_t
+  segment_size (unsigned k)
+  {
+    return S_first_segment << k;
+  }
+
+  Slot &
+  reserve_slot (size_type i)
+  {
+    const std::size_t j = i + S_first_segment;
+    const unsigned k = detail::floor_log2 (j) - S_first_segment_log2;
+    Slot *segment = M_segments[k].load (std::memory_order_acquire);
+    if (segment == nullptr)
+      {
+        Slot *fresh = Allocator<Slot> ().allocate (segment_size (k));
+        for (std::size_t n = 0; n < segment_size (k); ++n)
+          ::new (static_cast<void *> (&fresh[n].published))
+            std::atomic<bool> (false);
+        // Only one of the threads racing for a segment installs it.
+        if (M_segments[k].compare_exchange_strong (segment, fresh,
+                                                   std::memory_order_acq_rel))
+          segment = fresh;
+        else
+          Allocator<Slot> ().deallocate (fresh, segment_size (k));
+      }
+    return segment[j - (S_first_segment << k)];
+  }
+
+  std::atomic<Slot *> M_segments[S_segments] {};
+  std::atomic<size_type> M_size {0};
+};
+#endif
+
+#if ((defined (_GLIBCXX_COROUTINE) \
+      || defined (_LIBCPP_COROUTINE) \
+      || defined (_COROUTINE_)) \
+     && !defined (ARENA_HAS_COROUTINE_DEF))
+#define ARENA_HAS_COROUTINE_DEF
+/**
+ * A base for coroutine promise types, allocating the coroutine frames from
+ * the arena current when the coroutine is called.
+ *
+ * Nested coroutines whose promise types also derive from it get their frames
+ * from the same arena.  Frames of up to about 1 KiB are recycled through free
+ * lists of the arena without taking the global lock; their memory is only
+ * released when the arena is reset or destroyed.
+ */
+struct CoroutineFrame
+{
+  static void *
+  operator new (std::size_t n)
+  {
+    if (void *p = detail::allocate_frame (n))
+      return p;
+    return Allocator<std::max_align_t> ().allocate (frame_size (n));
+  }
+
+  static void
+  operator delete (void *p, std::size_t n)
+  {
+    if (!detail::deallocate_frame (p, n))
+      Allocator<std::max_align_t> ()
+        .deallocate (static_cast<std::max_align_t *> (p), frame_size (n));
+  }
+
+private:
+  static std::size_t
+  frame_size (std::size_t n)
+  {
+    return (n + sizeof (std::max_align_t) - 1) / sizeof (std::max_align_t);
+  }
+};
+#endif
+
 }
 
@@ -0,0 +1,139 @@
+// Compares allocating coroutine frames with the global ‘operator new’, from
+// the default arena, and from a request arena that is reset after every
+// request.
+//
+//   g++ -std=c++20 -O2 -I. bench/coroutine_frames.cc arena_alloc.cc -pthread
+//   ./a.out [requests]
+#include <coroutine>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <utility>
+#include "arena_alloc.hh"
+
+struct HeapFrame
+{
+};
+
+template <class Allocation>
+struct Task
+{
+  struct promise_type : Allocation
+  {
+    int value = 0;
+    std::coroutine_handle<> continuation {};
+
+    Task
+    get_return_object ()
+    {
+      return Task (std::coroutine_handle<promise_type>::from_promise (*this));
+    }
+
+    std::suspend_always initial_suspend () noexcept { return {}; }
+
+    auto
+    final_suspend () noexcept
+    {
+      struct Final
+      {
+        bool await_ready () noexcept { return false; }
+
+        std::coroutine_handle<>
+        await_suspend (std::coroutine_handle<promise_type> h) noexcept
+        {
+          const auto c = h.promise ().continuation;
+          return c ? c : std::noop_coroutine ();
+        }
+
+        void await_resume () noexcept { }
+      };
+      return Final {};
+    }
+
+    void return_value (int v) { value = v; }
+    void unhandled_exception () { std::terminate (); }
+  };
+
+  explicit Task (std::coroutine_handle<promise_type> h) : M_handle (h) { }
+  Task (Task &&other) noexcept : M_handle (std::exchange (other.M_handle, {})) { }
+  ~Task () { if (M_handle) M_handle.destroy (); }
+
+  bool await_ready () const noexcept { return false; }
+
+  std::coroutine_handle<>
+  await_suspend (std::coroutine_handle<> caller) noexcept
+  {
+    M_handle.promise ().continuation = caller;
+    return M_handle;
+  }
+
+  int await_resume () { return M_handle.promise ().value; }
+
+  int
+  run ()
+  {
+    M_handle.resume ();
+    return M_handle.promise ().value;
+  }
+
+private:
+  std::coroutine_handle<promise_type> M_handle;
+};
+
+template <class Allocation>
+Task<Allocation>
+leaf (int x)
+{
+  co_return x + 1;
+}
+
+// A binary tree of nested coroutines, 2^(depth+2) - 1 frames per call.
+template <class Allocation>
+Task<Allocation>
+node (int depth, int x)
+{
+  if (depth == 0)
+    co_return co_await leaf<Allocation> (x);
+  const int a = co_await node<Allocation> (depth - 1, x);
+  const int b = co_await node<Allocation> (depth - 1, x + 1);
+  co_return a + b;
+}
+
+enum { S_depth = 4, S_frames_per_request = (4 << S_depth) - 1 };
+
+template <class Allocation, class Request>
+static void
+bench (const char *name, long requests, Request &&request)
+{
+  long sink = 0;
+  const auto start = std::chrono::steady_clock::now ();
+  for (long i = 0; i < requests; ++i)
+    sink += request ([i] { return node<Allocation> (S_depth, i).run (); });
+  const std::chrono::duration<double, std::nano> elapsed
+    = std::chrono::steady_clock::now () - start;
+  std::printf ("%-16s %8.2f ns/frame  (%ld)\n", name,
+               elapsed.count () / (requests * S_frames_per_request), sink);
+}
+
+int
+main (int argc, char **argv)
+{
+  const long requests = argc > 1 ? std::atol (argv[1]) : 200000;
+  const auto plain = [] (auto &&run) { return run (); };
+
+  bench<HeapFrame> ("operator new", requests, plain);
+  bench<arena::CoroutineFrame> ("default arena", requests, plain);
+
+  arena::Arena request_arena;
+  bench<arena::CoroutineFrame> ("request arena", requests,
+                                [&] (auto &&run) {
+                                  int result;
+                                  {
+                                    arena::Scope scope (request_arena);
+                                    result = run ();
+                                  }
+                                  request_arena.reset ();
+                                  return result;
+                                });
+}
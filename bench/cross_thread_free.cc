@@ -0,0 +1,245 @@
+// Allocates objects on producer threads and frees them on consumer threads,
+// with ‘malloc’ and with the default arena, and reports throughput, tail
+// latency of allocation and deallocation, and how much memory the arena maps
+// compared to the peak of live bytes.
+//
+//   g++ -std=c++17 -O2 -I. bench/cross_thread_free.cc arena_alloc.cc -pthread
+//   ./a.out [producers] [consumers] [min_size] [max_size] [objects]
+//
+// Each producer allocates ‘objects’ objects of ‘min_size’ to ‘max_size’
+// bytes; at most 4096 objects are in flight between producers and consumers.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "arena_alloc.hh"
+
+using bench_clock = std::chrono::steady_clock;
+
+struct Object
+{
+  char *p;
+  std::size_t n;
+};
+
+class Queue
+{
+public:
+  explicit Queue (std::size_t capacity) : M_capacity (capacity) { }
+
+  void
+  push (Object object)
+  {
+    std::unique_lock<std::mutex> lock (M_mutex);
+    M_not_full.wait (lock, [&] { return M_objects.size () < M_capacity; });
+    M_objects.push_back (object);
+    M_not_empty.notify_one ();
+  }
+
+  // Returns false once the queue is closed and drained.
+  bool
+  pop (Object &object)
+  {
+    std::unique_lock<std::mutex> lock (M_mutex);
+    M_not_empty.wait (lock, [&] { return !M_objects.empty () || M_closed; });
+    if (M_objects.empty ())
+      return false;
+    object = M_objects.front ();
+    M_objects.pop_front ();
+    M_not_full.notify_one ();
+    return true;
+  }
+
+  void
+  close ()
+  {
+    const std::lock_guard<std::mutex> lock (M_mutex);
+    M_closed = true;
+    M_not_empty.notify_all ();
+  }
+
+private:
+  std::mutex M_mutex;
+  std::condition_variable M_not_full;
+  std::condition_variable M_not_empty;
+  std::deque<Object> M_objects;
+  std::size_t M_capacity;
+  bool M_closed = false;
+};
+
+struct Malloc
+{
+  static constexpr bool S_arena = false;
+
+  static char *
+  allocate (std::size_t n)
+  {
+    return static_cast<char *> (std::malloc (n));
+  }
+
+  static void deallocate (char *p, std::size_t) { std::free (p); }
+};
+
+struct Arena
+{
+  static constexpr bool S_arena = true;
+
+  static char *
+  allocate (std::size_t n)
+  {
+    return arena::Allocator<char> ().allocate (n);
+  }
+
+  static void
+  deallocate (char *p, std::size_t n)
+  {
+    arena::Allocator<char> ().deallocate (p, n);
+  }
+};
+
+struct Options
+{
+  unsigned producers;
+  unsigned consumers;
+  std::size_t min_size;
+  std::size_t max_size;
+  long objects;
+};
+
+enum : std::size_t { S_in_flight = 4096 };
+
+// Nanoseconds per operation, sampled every 16th operation.
+using Samples = std::vector<std::uint32_t>;
+
+static std::uint32_t
+elapsed_ns (bench_clock::time_point start)
+{
+  const std::chrono::nanoseconds elapsed = bench_clock::now () - start;
+  return static_cast<std::uint32_t> (std::min<long long> (elapsed.count (),
+                                                          UINT32_MAX));
+}
+
+static void
+print_latency (const char *name, std::vector<Samples> &per_thread)
+{
+  Samples all;
+  for (auto &samples : per_thread)
+    all.insert (all.end (), samples.begin (), samples.end ());
+  if (all.empty ())
+    return;
+  std::sort (all.begin (), all.end ());
+  const auto at = [&] (double q) {
+    const auto i = static_cast<std::size_t> (q * all.size ());
+    return all[std::min (all.size () - 1, i)];
+  };
+  std::printf ("  %-10s p50 %6u ns  p99 %6u ns  p99.9 %7u ns  max %8u ns\n",
+               name, at (0.5), at (0.99), at (0.999), all.back ());
+}
+
+template <class Allocation>
+static void
+bench (const char *name, const Options &options)
+{
+  Queue queue (S_in_flight);
+  std::atomic<long> live_bytes {0};
+  std::atomic<long> peak_live_bytes {0};
+  std::atomic<bool> done {false};
+  std::size_t peak_mapped = 0;
+  std::vector<Samples> allocate_ns (options.producers);
+  std::vector<Samples> deallocate_ns (options.consumers);
+
+  // Samples the memory mapped by the arena while the benchmark runs.
+  std::thread monitor ([&] {
+    while (Allocation::S_arena && !done.load (std::memory_order_relaxed))
+      {
+        const auto mapped = arena::statistics ().mapped_bytes;
+        peak_mapped = std::max (peak_mapped, mapped);
+        std::this_thread::sleep_for (std::chrono::milliseconds (1));
+      }
+  });
+
+  const auto start = bench_clock::now ();
+  std::vector<std::thread> producers, consumers;
+  for (unsigned t = 0; t < options.producers; ++t)
+    producers.emplace_back ([&, t] {
+      std::minstd_rand random (t + 1);
+      std::uniform_int_distribution<std::size_t> size (options.min_size,
+                                                       options.max_size);
+      for (long i = 0; i < options.objects; ++i)
+        {
+          const std::size_t n = size (random);
+          const auto before = bench_clock::now ();
+          char *p = Allocation::allocate (n);
+          if (i % 16 == 0)
+            allocate_ns[t].push_back (elapsed_ns (before));
+          std::memset (p, static_cast<int> (i), n);
+          const long live = live_bytes.fetch_add (n) + n;
+          long peak = peak_live_bytes.load (std::memory_order_relaxed);
+          while (live > peak
+                 && !peak_live_bytes.compare_exchange_weak (peak, live))
+            ;
+          queue.push ({p, n});
+        }
+    });
+  for (unsigned t = 0; t < options.consumers; ++t)
+    consumers.emplace_back ([&, t] {
+      Object object;
+      for (long i = 0; queue.pop (object); ++i)
+        {
+          live_bytes.fetch_sub (object.n);
+          const auto before = bench_clock::now ();
+          Allocation::deallocate (object.p, object.n);
+          if (i % 16 == 0)
+            deallocate_ns[t].push_back (elapsed_ns (before));
+        }
+    });
+  for (auto &p : producers)
+    p.join ();
+  queue.close ();
+  for (auto &c : consumers)
+    c.join ();
+  const std::chrono::duration<double> elapsed = bench_clock::now () - start;
+  done = true;
+  monitor.join ();
+
+  const double total = 1.0 * options.objects * options.producers;
+  std::printf ("%s: %.2f M objects/s\n", name, total / elapsed.count () / 1e6);
+  print_latency ("allocate", allocate_ns);
+  print_latency ("deallocate", deallocate_ns);
+  if (peak_mapped)
+    std::printf ("  peak mapped %zu KiB for peak live %ld KiB (%.1fx)\n",
+                 peak_mapped / 1024, peak_live_bytes.load () / 1024,
+                 static_cast<double> (peak_mapped) / peak_live_bytes.load ());
+}
+
+int
+main (int argc, char **argv)
+{
+  Options options;
+  options.producers = argc > 1 ? std::atoi (argv[1]) : 2;
+  options.consumers = argc > 2 ? std::atoi (argv[2]) : 2;
+  options.min_size = argc > 3 ? std::atol (argv[3]) : 16;
+  options.max_size = argc > 4 ? std::atol (argv[4]) : 256;
+  options.objects = argc > 5 ? std::atol (argv[5]) : 500000;
+  if (options.producers == 0 || options.consumers == 0 || options.min_size == 0
+      || options.max_size < options.min_size)
+    {
+      std::fputs ("usage: cross_thread_free [producers] [consumers] [min_size]"
+                  " [max_size] [objects]\n", stderr);
+      return 1;
+    }
+
+  std::printf ("%u producers, %u consumers, %zu-%zu bytes, %ld objects each\n",
+               options.producers, options.consumers, options.min_size,
+               options.max_size, options.objects);
+  bench<Malloc> ("malloc", options);
+  bench<Arena> ("default arena", options);
+}
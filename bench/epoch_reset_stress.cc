@@ -0,0 +1,126 @@
+// Stresses retiring memory with ‘epoch::retire’ from arenas that are reset
+// and destroyed while readers are inside critical sections.  Every retired
+// object checks in its destructor that its memory is still intact, and the
+// program fails if an object was destroyed twice, never, or after its memory
+// was reused.
+//
+//   g++ -std=c++17 -O2 -I. bench/epoch_reset_stress.cc arena_alloc.cc -pthread
+//   ./a.out [threads] [iterations]
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "arena_alloc.hh"
+
+enum : unsigned { S_alive = 0x5a5a5a5a, S_dead = 0xdeadbeef };
+
+static std::atomic<long> S_constructed {0};
+static std::atomic<long> S_destroyed {0};
+static std::atomic<long> S_corrupted {0};
+
+struct Object
+{
+  unsigned magic = S_alive;
+  long value;
+
+  explicit Object (long v) : value (v) { ++S_constructed; }
+
+  ~Object ()
+  {
+    if (magic != S_alive)
+      ++S_corrupted;
+    magic = S_dead;
+    ++S_destroyed;
+  }
+};
+
+// The single-threaded case: retire, reset, reuse the memory, synchronize.
+static void
+retire_then_reset ()
+{
+  arena::Arena a;
+  {
+    arena::Scope scope (a);
+    Object *p = arena::Allocator<Object> ().allocate (1);
+    ::new (p) Object (1);
+    arena::epoch::retire (p);
+  }
+  a.reset ();
+  {
+    arena::Scope scope (a);
+    // Overwrites the retired object if its memory was released too early.
+    unsigned *q = arena::Allocator<unsigned> ().allocate (64);
+    for (unsigned i = 0; i < 64; ++i)
+      q[i] = 0;
+  }
+  arena::epoch::synchronize ();
+}
+
+static void
+worker (long iterations, const std::atomic<bool> &stop)
+{
+  for (long i = 0; i < iterations && !stop; ++i)
+    {
+      arena::Arena a;
+      arena::Scope scope (a);
+      for (int j = 0; j < 8; ++j)
+        {
+          Object *p = arena::Allocator<Object> ().allocate (1);
+          ::new (p) Object (i);
+          arena::epoch::retire (p);
+          int *n = arena::Allocator<int> ().allocate (1);
+          *n = j;
+          arena::epoch::retire (n);
+        }
+      // Alternately reset the arena and reuse it, or destroy it right away.
+      if (i % 2 == 0)
+        {
+          a.reset ();
+          int *n = arena::Allocator<int> ().allocate (16);
+          for (int j = 0; j < 16; ++j)
+            n[j] = -1;
+        }
+    }
+}
+
+static void
+reader (const std::atomic<bool> &stop)
+{
+  while (!stop)
+    {
+      arena::epoch::Guard guard;
+      std::this_thread::yield ();
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  const unsigned threads = argc > 1 ? std::atoi (argv[1]) : 4;
+  const long iterations = argc > 2 ? std::atol (argv[2]) : 20000;
+
+  retire_then_reset ();
+
+  std::atomic<bool> stop {false};
+  std::thread r (reader, std::cref (stop));
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; ++t)
+    workers.emplace_back (worker, iterations, std::cref (stop));
+  for (auto &w : workers)
+    w.join ();
+  stop = true;
+  r.join ();
+  arena::epoch::synchronize ();
+
+  std::printf ("constructed %ld, destroyed %ld, corrupted %ld\n",
+               S_constructed.load (), S_destroyed.load (),
+               S_corrupted.load ());
+  if (S_corrupted || S_constructed != S_destroyed)
+    {
+      std::puts ("FAILED");
+      return 1;
+    }
+  std::puts ("ok");
+  return 0;
+}